@@ -1,462 +1,4168 @@
 #ifndef FILEMANAGER_FILEMANAGER_H
 #define FILEMANAGER_FILEMANAGER_H
 
+#include <array>
+#include <cerrno>
 #include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define FILEMANAGER_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FILEMANAGER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define FILEMANAGER_TARGET_AVX2
+#define FILEMANAGER_TARGET_SSE42
+#else
+#define FILEMANAGER_TARGET_AVX2 __attribute__((target("avx2")))
+#define FILEMANAGER_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
 #define COMMAND_DELIMITER ';'
 #define ESTIMATED_CHARS_PER_ROW 64
 #define CACHE_BUFFER_SIZE 10
+#define COMPACT_THRESHOLD 50
+#define ARENA_BLOCK_SIZE (1 << 20)
 #define JOURNAL_FLUSH_THRESHOLD 16
+#define SCAN_BLOCK_SIZE (1 << 20)
+#define WRITE_BLOCK_SIZE (4 << 20)
+#define INDEX_FORMAT_VERSION 1
+#define PAGE_LINES 4096
+#define PAGE_MEMORY_BUDGET (64 << 20)
+#define ORDER_CHUNK_SIZE 1024
+#define JOURNAL_MAGIC "\x89" "FMJ"
+#define JOURNAL_TAIL_SIZE 64
 
 class FileManager {
     enum class Command : char {
         Append = 'A',
+        Batch = 'B',
         Clear = 'C',
         Erase = 'E',
-        Overwrite = 'O'
+        Insert = 'I',
+        Overwrite = 'O',
+        PopFront = 'P',
+        EraseRanges = 'R',
+        Commit = 'Z'
+    };
+
+    class NewlineScanner {
+    public:
+        /**
+         * @brief Reports the position of every newline in a block of bytes
+         * @param data Start of the block
+         * @param size Length of the block
+         * @param on_newline Called with the offset of each newline, in ascending order
+         * @note Picks the widest kernel the CPU supports at runtime (AVX2, SSE2 or scalar)
+         */
+        template <typename F>
+        static void scan(const char* data, const size_t size, F&& on_newline) {
+#ifdef FILEMANAGER_X86
+            if (_has_avx2()) {
+                _scan_avx2(data, size, on_newline);
+            }
+            else {
+                _scan_sse2(data, size, on_newline);
+            }
+#else
+            _scan_scalar(data, size, 0, on_newline);
+#endif
+        }
+
+        /**
+         * @brief Splits a block of bytes into lines, with the same semantics as std::getline
+         * @param data Bytes to split
+         * @param on_line Called with every line, excluding its newline
+         */
+        template <typename F>
+        static void split(const std::string_view data, F&& on_line) {
+            size_t start = 0;
+
+            scan(data.data(), data.size(), [&](const size_t newline) {
+                on_line(data.substr(start, newline - start));
+                start = newline + 1;
+            });
+
+            // A trailing newline doesn't start another line
+            if (start < data.size()) {
+                on_line(data.substr(start));
+            }
+        }
+
+        /**
+         * @brief Reads a stream in SCAN_BLOCK_SIZE blocks and splits it into lines
+         * @param in Stream to consume
+         * @param on_line Called with every line, excluding its newline. The view is only valid during the call
+         */
+        template <typename F>
+        static void split(std::istream& in, F&& on_line) {
+            std::unique_ptr<char[]> buffer(new char[SCAN_BLOCK_SIZE]);
+            std::string carry;
+
+            while (in) {
+                in.read(buffer.get(), SCAN_BLOCK_SIZE);
+                const auto count = static_cast<size_t>(in.gcount());
+                if (count == 0) break;
+
+                size_t start = 0;
+
+                scan(buffer.get(), count, [&](const size_t newline) {
+                    const std::string_view part(buffer.get() + start, newline - start);
+
+                    if (carry.empty()) {
+                        on_line(part);
+                    }
+                    else {
+                        carry.append(part);
+                        on_line(std::string_view(carry));
+                        carry.clear();
+                    }
+
+                    start = newline + 1;
+                });
+
+                // Lines crossing a block boundary are stitched together in the carry buffer
+                carry.append(buffer.get() + start, count - start);
+            }
+
+            if (!carry.empty()) {
+                on_line(std::string_view(carry));
+            }
+        }
+
+    private:
+        template <typename F>
+        static void _scan_scalar(const char* data, const size_t size, size_t offset, F& on_newline) {
+            while (offset < size) {
+                const auto* newline = static_cast<const char*>(std::memchr(data + offset, '\n', size - offset));
+                if (newline == nullptr) return;
+
+                offset = static_cast<size_t>(newline - data);
+                on_newline(offset);
+                ++offset;
+            }
+        }
+
+#ifdef FILEMANAGER_X86
+        /**
+         * @brief Calls the callback for every set bit of a comparison mask
+         */
+        template <typename F>
+        static void _emit(unsigned int mask, const size_t base, F& on_newline) {
+            while (mask != 0) {
+#ifdef _MSC_VER
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+#else
+                const auto bit = static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
+                on_newline(base + bit);
+                mask &= mask - 1;
+            }
+        }
+
+        template <typename F>
+        static void _scan_sse2(const char* data, const size_t size, F& on_newline) {
+            const __m128i newline = _mm_set1_epi8('\n');
+            size_t offset = 0;
+
+            for (; offset + 16 <= size; offset += 16) {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+                _emit(static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline))), offset, on_newline);
+            }
+
+            _scan_scalar(data, size, offset, on_newline);
+        }
+
+        template <typename F>
+        FILEMANAGER_TARGET_AVX2 static void _scan_avx2(const char* data, const size_t size, F& on_newline) {
+            const __m256i newline = _mm256_set1_epi8('\n');
+            size_t offset = 0;
+
+            for (; offset + 32 <= size; offset += 32) {
+                const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset));
+                _emit(static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline))), offset, on_newline);
+            }
+
+            _scan_scalar(data, size, offset, on_newline);
+        }
+
+        [[nodiscard]] static bool _has_avx2() {
+            static const bool supported = [] {
+#ifdef _MSC_VER
+                int info[4];
+                __cpuid(info, 0);
+                if (info[0] < 7) return false;
+
+                __cpuidex(info, 7, 0);
+                const bool cpu_avx2 = (info[1] & (1 << 5)) != 0;
+
+                __cpuid(info, 1);
+                const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+
+                return cpu_avx2 && os_saves_ymm;
+#else
+                return __builtin_cpu_supports("avx2") != 0;
+#endif
+            }();
+
+            return supported;
+        }
+#endif
     };
 
     class Journal {
-        struct Token {
-            bool isValid = false;
-            std::string value;
+    public:
+        // Journal related part of the Options, see FileManager::_journal_settings()
+        struct Settings {
+            // Whether new journals use the binary format
+            bool binary = false;
+            // Journal size in bytes which starts a background compaction, 0 disables it
+            uint64_t compact_threshold = 0;
+            // Whether every write to the journal is followed by fdatasync
+            bool sync_writes = false;
+            // Whether save() waits for a sync shared with every thread saving at the same time
+            bool group_commit = false;
+            // Time the thread performing a group commit waits for other threads to join it
+            std::chrono::microseconds group_commit_window{};
+            // Limits of unsaved records, whichever is reached first writes them, 0 disables a limit
+            size_t flush_records = JOURNAL_FLUSH_THRESHOLD;
+            size_t flush_bytes = 0;
+            std::chrono::milliseconds flush_age{};
+            // Whether records are written by a separate thread instead of the recording one
+            bool background_flush = false;
         };
 
-    public:
-        explicit Journal(std::filesystem::path journal_path) :
-            _journal_path(std::move(journal_path))
-        {}
+        /**
+         * @param journal_path Location of the journal file
+         * @param settings Format, compaction and durability of the journal
+         * @note An existing journal keeps its format until it is destroyed, so new records always match the file
+         */
+        Journal(std::filesystem::path journal_path, const Settings& settings) :
+            _journal_path(std::move(journal_path)),
+            _compact_path(std::filesystem::path(_journal_path) += ".tmp"),
+            _retired_path(std::filesystem::path(_journal_path) += ".old"),
+            _settings(settings),
+            _binary(std::filesystem::exists(_journal_path) ? _is_binary() : settings.binary)
+        {
+            std::error_code ec;
+            std::filesystem::remove(_compact_path, ec);
+
+            // A header torn by a crash has no records behind it, new ones must not be appended to it
+            if (_binary && std::filesystem::file_size(_journal_path, ec) < sizeof(JOURNAL_MAGIC) - 1 && !ec) {
+                std::filesystem::remove(_journal_path);
+                _binary = settings.binary;
+            }
+
+            if (_settings.background_flush) {
+                _flusher = std::thread(&Journal::_run_flusher, this);
+            }
+        }
+
+        ~Journal() {
+            if (_flusher.joinable()) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _stopping = true;
+                }
+
+                _flush_condition.notify_one();
+                _flusher.join();
+            }
+
+            try {
+                std::lock_guard<std::mutex> io_lock(_io_mutex);
+                _finish_compaction(true);
+            }
+            catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+
+            _close();
+        }
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
 
         /**
          * @brief Creates a journal entry for a file manager method call
          * @param command Type of the method call
          * @param args Arguments during call (optional)
-         * @note Doesn't write to the journal instantly, stores it in a vector instead which is
-         * flushed on the next save. Saves if amount of unsaved records exceed JOURNAL_FLUSH_THRESHOLD
+         * @note Doesn't write to the journal instantly, appends it to a buffer instead which is
+         * flushed on the next save or once the unsaved records exceed a limit of the flush policy
          */
         template <typename... Args>
-        void record(const Command command, Args... args) {
-            std::string entry;
-            entry.push_back(static_cast<char>(command));
-            entry.push_back(COMMAND_DELIMITER);
+        void record(const Command command, const Args&... args) {
+            bool due;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _materialize_pops();
 
-            if (sizeof...(Args) > 0) {
-                ((entry += tokenize(std::forward<Args>(args))), ...);
+                const size_t start = _open_record(command);
+                (tokenize(_pending, args), ...);
+                _close_record(start);
+                due = _flush_due();
             }
 
-            _pending_commands.push_back(std::move(entry));
-            _outdated = true;
+            if (due) _request_flush();
+        }
+
+        /**
+         * @brief Creates a single journal entry for a sequence of arguments
+         * @param command Type of the method call
+         * @param first Iterator to the first argument
+         * @param last Iterator past the last argument
+         * @note The record starts with the amount of arguments, so a record torn by a crash is recognized on replay
+         */
+        template <typename It>
+        void record_range(const Command command, It first, const It last) {
+            bool due;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _materialize_pops();
+
+                const size_t start = _open_record(command);
+                tokenize(_pending, static_cast<size_t>(std::distance(first, last)));
+
+                for (; first != last; ++first) {
+                    tokenize(_pending, *first);
+                }
+
+                _close_record(start);
+                due = _flush_due();
+            }
+
+            if (due) _request_flush();
+        }
 
-            if (_pending_commands.size() >= JOURNAL_FLUSH_THRESHOLD) {
-                save();
+        /**
+         * @brief Creates a journal entry for erasing the first line
+         * @note Consecutive calls are merged into a single PopFront record carrying the amount of erased lines
+         */
+        void record_pop() {
+            bool due;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                ++_pending_pops;
+                _mark_outdated();
+                due = _flush_due();
             }
+
+            if (due) _request_flush();
         }
 
         /**
          * @brief Calls every method recorded in the journal
          * @param callback Function which handles internal file manager method calls from journal
+         * @note The journal is mapped and parsed in place, the arguments passed to the callback point into
+         * the mapping and are only valid during the call. Records which are superseded by later ones are
+         * skipped, see _compact(). A retired segment is replayed before the current one. Only used before
+         * anything is recorded, so it doesn't lock the journal
          */
         template<typename F>
         void replay(F&& callback) const {
-            std::ifstream in(_journal_path);
-            std::string line;
-            std::vector<std::string> args;
-            args.reserve(2);
+            for (const auto& path : {_retired_path, _journal_path}) {
+                if (!std::filesystem::exists(path)) continue;
+
+                const MappedFile file(path);
+                const std::string_view journal(file.data(), file.size());
+                std::vector<std::string_view> args;
+                const std::vector<bool> keep = _compact(journal, args);
+                size_t record = 0;
+
+                _parse(journal, args, [&](const Command command, const std::vector<std::string_view>& record_args, std::string_view) {
+                    if (keep[record++]) callback(command, record_args);
+                });
+            }
+        }
+
+        /**
+         * @brief Calls a callback with the last record of the current segment, without reading the rest of it
+         * @param callback Callable taking the command and its arguments
+         * @note Only the last JOURNAL_TAIL_SIZE bytes are read, which always hold a Commit record. Longer or torn
+         * records aren't reported. Binary records are found by trying every start whose record ends with the file
+         */
+        template<typename F>
+        void last_record(F&& callback) const {
+            std::ifstream in(_journal_path, std::ios::binary | std::ios::ate);
+            if (!in.is_open()) return;
+
+            const std::streamoff size = in.tellg();
+            if (size <= 0) return;
+
+            const std::streamoff start = std::max<std::streamoff>(0, size - JOURNAL_TAIL_SIZE);
+            std::string tail(static_cast<size_t>(size - start), '\0');
+            in.seekg(start);
+            if (!in.read(tail.data(), static_cast<std::streamsize>(tail.size()))) return;
+
+            std::vector<std::string_view> args;
+
+            if (!_is_binary()) {
+                if (tail.size() < 2 || tail.back() != '\n') return;
+
+                const size_t newline = tail.rfind('\n', tail.size() - 2);
+                if (newline == std::string::npos && start > 0) return;
+
+                const std::string_view line = std::string_view(tail).substr(newline + 1, tail.size() - newline - 2);
+                if (line.empty()) return;
+
+                _split_line(line, args);
+                callback(static_cast<Command>(line[0]), args);
+                return;
+            }
+
+            const size_t first = start > 0 ? 0 : sizeof(JOURNAL_MAGIC) - 1;
+
+            for (size_t position = tail.size(); position-- > first;) {
+                size_t cursor = position;
+
+                if (_read_record(tail, cursor, args) && cursor == tail.size()) {
+                    callback(static_cast<Command>(tail[position]), args);
+                    return;
+                }
+            }
+        }
+
+        /**
+         * @brief Removes the journal file and a retired segment
+         */
+        void destroy() {
+            std::lock_guard<std::mutex> io_lock(_io_mutex);
+            _cancel_compaction();
+            _close();
+            std::filesystem::remove(_journal_path);
+            std::filesystem::remove(_retired_path);
+            _compacted_size = 0;
+            ++_generation;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _binary = _settings.binary;
+            _pending.clear();
+            _pending_records = 0;
+            _pending_pops = 0;
+            _outdated = false;
+            _flush_requested = false;
+            _flush_failed = false;
+        }
+
+        /**
+         * @brief Appends unsaved commands to the journal
+         * @note Waits for a write of the background flusher which is in progress, so everything recorded
+         * before the call is written once it returns. With group commit enabled, also waits until a sync
+         * covers it. Other threads saving in the meantime share that sync
+         */
+        void save() {
+            std::unique_lock<std::mutex> io_lock(_io_mutex);
+            _flush();
+            if (_settings.group_commit) _group_commit(io_lock);
+        }
+
+        /**
+         * @brief Moves everything recorded so far into a retired segment and starts a new, empty one
+         * @note Used by consolidate_async(), which writes the retired changes into the file while new ones are
+         * recorded. The retired segment is discarded once the file holds its changes
+         */
+        void rotate() {
+            std::lock_guard<std::mutex> io_lock(_io_mutex);
+            _flush();
+            _cancel_compaction();
+
+#ifdef FILEMANAGER_POSIX
+            // Threads waiting for a group commit stop caring once the file changes, so it is synced for them
+            if (_durable() && _file >= 0 && !_sync_descriptor(_file)) throw std::runtime_error("could not sync journal");
+#endif
+
+            _close();
+
+            if (std::filesystem::exists(_journal_path)) {
+                std::filesystem::rename(_journal_path, _retired_path);
+                if (_durable()) _sync_directory(_retired_path);
+            }
+
+            _compacted_size = 0;
+            ++_generation;
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _binary = _settings.binary;
+        }
+
+        /**
+         * @brief Removes the retired segment, once its changes are part of the file
+         * @note Thread-safe, only touches the file system
+         */
+        void discard_retired() const {
+            std::error_code ec;
+            std::filesystem::remove(_retired_path, ec);
+        }
+
+        /**
+         * @brief Checks whether the journal file or a retired segment exists
+         * @return True if there is anything to replay
+         */
+        [[nodiscard]] bool exists() const {
+            return std::filesystem::exists(_journal_path) || retired();
+        }
+
+        /**
+         * @brief Checks whether a retired segment exists
+         * @return True if a consolidate_async() didn't finish
+         */
+        [[nodiscard]] bool retired() const {
+            return std::filesystem::exists(_retired_path);
+        }
+
+    private:
+        /**
+         * @brief Writes the unsaved records now or has the background flusher write them
+         */
+        void _request_flush() {
+            if (!_settings.background_flush) {
+                std::lock_guard<std::mutex> io_lock(_io_mutex);
+                _flush();
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _flush_requested = true;
+            }
+
+            _flush_condition.notify_one();
+        }
 
-            if (!in.is_open()) throw std::runtime_error("couldnt open file");
+        /**
+         * @brief Body of the background flusher thread
+         * @note Waits until a flush is requested or the oldest record reaches the maximum age. A failed flush
+         * keeps its records, they are written again by the next save, which reports the error
+         */
+        void _run_flusher() {
+            std::unique_lock<std::mutex> lock(_mutex);
 
-            while (std::getline(in, line)) {
-                const auto command = static_cast<Command>(line[0]);
-                size_t cursor = 2;
-                args.clear();
+            while (!_stopping) {
+                if (_flush_requested || (_outdated && !_flush_failed && _aged())) {
+                    lock.unlock();
 
-                while (cursor != std::string::npos) {
-                    if (auto [isValid, value] = _extract_token(line, cursor); isValid) {
-                        args.push_back(std::move(value));
+                    try {
+                        std::lock_guard<std::mutex> io_lock(_io_mutex);
+                        _flush();
+                        lock.lock();
                     }
-                    else {
-                        break;
+                    catch (std::exception& e) {
+                        lock.lock();
+                        _flush_failed = true;
+                        std::cerr << e.what() << std::endl;
                     }
+
+                    _flush_requested = false;
+                    continue;
+                }
+
+                if (_outdated && !_flush_failed && _settings.flush_age.count() != 0) {
+                    _flush_condition.wait_until(lock, _outdated_since + _settings.flush_age);
+                }
+                else {
+                    _flush_condition.wait(lock);
+                }
+            }
+        }
+
+        /**
+         * @brief Writes unsaved commands to the journal
+         * @note Needs the I/O lock. The pending buffer is swapped out under the record lock, so recording goes
+         * on while the records are written. The journal stays open between flushes, all pending records are
+         * written with a single call
+         */
+        void _flush() {
+            _finish_compaction(false);
+            size_t records;
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _flush_requested = false;
+                _flush_failed = false;
+                if (!_outdated) return;
+
+                _materialize_pops();
+                _writing.swap(_pending);
+                records = _pending_records;
+                _pending_records = 0;
+                _outdated = false;
+            }
+
+            std::optional<uint64_t> base;
+            size_t header = 0;
+
+            try {
+                _open();
+
+                // Binary journals are recognized by their header, written along with the first records so a
+                // crash can't leave a header without them
+                if (_binary && _size == 0) {
+                    header = sizeof(JOURNAL_MAGIC) - 1;
+                    _writing.insert(0, JOURNAL_MAGIC, header);
+                }
+
+                base = _size;
+                _write(_writing.data(), _writing.size());
+            }
+            catch (std::exception&) {
+                // Whatever didn't make it into the file goes back in front of the records made since
+                std::lock_guard<std::mutex> lock(_mutex);
+                _pending.insert(0, _writing, std::max(base ? static_cast<size_t>(_size - *base) : 0, header));
+                _pending_records += records;
+                _writing.clear();
+                _mark_outdated();
+                throw;
+            }
+
+            _writing.clear();
+
+#ifdef FILEMANAGER_POSIX
+            if (_settings.sync_writes && !_sync_descriptor(_file)) throw std::runtime_error("could not sync journal");
+#endif
+
+            _start_compaction();
+        }
+
+        /**
+         * @brief Waits until everything written to the journal so far reached the disk
+         * @param lock Held I/O lock, released while waiting
+         * @note The first thread to arrive leads the group: it waits for the group commit window, so other
+         * threads can write their records in the meantime, and then syncs once for all of them. Threads
+         * arriving while a sync is running wait for it and start the next group if it didn't cover them
+         */
+        void _group_commit(std::unique_lock<std::mutex>& lock) {
+#ifdef FILEMANAGER_POSIX
+            const uint64_t generation = _generation;
+            const uint64_t target = _size;
+
+            // A destroyed or compacted journal doesn't need the old file to be synced anymore
+            while (_generation == generation && _synced < target) {
+                if (_syncing) {
+                    _synced_condition.wait(lock);
+                    continue;
+                }
+
+                _syncing = true;
+                lock.unlock();
+                std::this_thread::sleep_for(_settings.group_commit_window);
+                lock.lock();
+
+                // The file may be closed while the lock isn't held, the duplicate keeps it open for the sync
+                const uint64_t covered = _size;
+                const int file = _generation == generation ? ::dup(_file) : -1;
+
+                lock.unlock();
+                const bool synced = file >= 0 && _sync_descriptor(file);
+                if (file >= 0) ::close(file);
+                lock.lock();
+
+                _syncing = false;
+                _synced_condition.notify_all();
+
+                if (_generation != generation) break;
+                if (!synced) throw std::runtime_error("could not sync journal");
+
+                _synced = std::max(_synced, covered);
+            }
+#else
+            (void)lock;
+#endif
+        }
+
+        /**
+         * @brief Turns the pending pops into a single PopFront record
+         */
+        void _materialize_pops() {
+            if (_pending_pops == 0) return;
+
+            const size_t start = _open_record(Command::PopFront);
+            tokenize(_pending, _pending_pops);
+            _close_record(start);
+            _pending_pops = 0;
+        }
+
+        /**
+         * @brief Starts a new record at the end of the pending buffer
+         * @param command Type of the method call
+         * @return Offset of the record inside the pending buffer
+         */
+        size_t _open_record(const Command command) {
+            const size_t start = _pending.size();
+            _pending.push_back(static_cast<char>(command));
+            if (!_binary) _pending.push_back(COMMAND_DELIMITER);
+            return start;
+        }
+
+        /**
+         * @brief Finishes a record and queues it for the next save
+         * @param start Offset returned by _open_record(), the record was filled by tokenize() since
+         * @note Binary records are framed as opcode, varint payload length, payload and the CRC32C of all of it,
+         * text records are terminated by a newline
+         */
+        void _close_record(const size_t start) {
+            if (_binary) {
+                std::string length;
+                _append_varint(length, _pending.size() - start - 1);
+                _pending.insert(start + 1, length);
+
+                const uint32_t crc = _crc32c(std::string_view(_pending).substr(start));
+
+                for (int shift = 0; shift < 32; shift += 8) {
+                    _pending.push_back(static_cast<char>((crc >> shift) & 0xFF));
                 }
+            }
+            else {
+                _pending.push_back('\n');
+            }
+
+            ++_pending_records;
+            _mark_outdated();
+        }
+
+        /**
+         * @brief Notes that there are unsaved records and since when
+         */
+        void _mark_outdated() {
+            if (!_outdated && _settings.flush_age.count() != 0) {
+                _outdated_since = std::chrono::steady_clock::now();
+
+                // The background flusher has to learn when the records become too old
+                if (_settings.background_flush) _flush_condition.notify_one();
+            }
+
+            _outdated = true;
+        }
+
+        /**
+         * @brief Checks whether the unsaved records reached a limit of the flush policy
+         * @return True if they should be written now, false if the background flusher was asked to already
+         * @note Without background flusher, the age is only checked when recording, an idle journal keeps its
+         * records until the next save
+         */
+        [[nodiscard]] bool _flush_due() const {
+            if (_flush_requested || _flush_failed) return false;
+            if (_settings.flush_records != 0 && _pending_records + _pending_pops >= _settings.flush_records) return true;
+            if (_settings.flush_bytes != 0 && _pending.size() >= _settings.flush_bytes) return true;
+
+            return _aged();
+        }
+
+        /**
+         * @brief Checks whether the oldest unsaved record reached the maximum age of the flush policy
+         */
+        [[nodiscard]] bool _aged() const {
+            return _settings.flush_age.count() != 0 && std::chrono::steady_clock::now() - _outdated_since >= _settings.flush_age;
+        }
+
+        /**
+         * @brief Checks whether the journal is synced at all
+         * @return True if the durability policy syncs writes or commits them in groups
+         */
+        [[nodiscard]] bool _durable() const {
+            return _settings.sync_writes || _settings.group_commit;
+        }
+
+        /**
+         * @brief Opens the journal for appending unless it is open already
+         */
+        void _open() {
+#ifdef FILEMANAGER_POSIX
+            if (_file >= 0) return;
+
+            _file = ::open(_journal_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            if (_file < 0) throw std::runtime_error("could not open journal");
+
+            struct stat info {};
+            if (::fstat(_file, &info) != 0) {
+                _close();
+                throw std::runtime_error("could not stat journal");
+            }
+
+            _size = static_cast<uint64_t>(info.st_size);
+
+            // A newly created journal only survives a crash once its directory entry is synced
+            if (_size == 0 && _durable()) _sync_directory(_journal_path);
+#else
+            if (_file.is_open()) return;
+
+            std::error_code ec;
+            _size = std::filesystem::file_size(_journal_path, ec);
+            if (ec) _size = 0;
+
+            _file.open(_journal_path, std::ios::app | std::ios::binary);
+            if (!_file.is_open()) throw std::runtime_error("could not open journal");
+#endif
+        }
+
+        /**
+         * @brief Closes the journal, the next save opens it again
+         * @note The file may be replaced before it is opened again, so its size and how much of it was synced
+         * are forgotten and read again by _open()
+         */
+        void _close() {
+#ifdef FILEMANAGER_POSIX
+            if (_file >= 0) ::close(_file);
+            _file = -1;
+#else
+            _file.close();
+#endif
+            _size = 0;
+            _synced = 0;
+        }
+
+        /**
+         * @brief Appends bytes to the open journal
+         * @param data Bytes to write
+         * @param size Amount of bytes
+         */
+        void _write(const char* data, const size_t size) {
+#ifdef FILEMANAGER_POSIX
+            for (size_t done = 0; done < size;) {
+                const ssize_t bytes = ::write(_file, data + done, size - done);
+
+                if (bytes < 0 && errno == EINTR) continue;
+                if (bytes <= 0) throw std::runtime_error("could not write journal");
+
+                done += static_cast<size_t>(bytes);
+                _size += static_cast<uint64_t>(bytes);
+            }
+#else
+            _file.write(data, static_cast<std::streamsize>(size));
+            _file.flush();
+            if (!_file) throw std::runtime_error("could not write journal");
+
+            _size += size;
+#endif
+        }
+
+        /**
+         * @brief Checks whether the journal file starts with JOURNAL_MAGIC
+         * @return True if the journal is binary
+         * @note A file holding only part of JOURNAL_MAGIC is a binary journal whose first write was torn
+         */
+        [[nodiscard]] bool _is_binary() const {
+            std::ifstream in(_journal_path, std::ios::binary);
+            char magic[sizeof(JOURNAL_MAGIC) - 1];
+            in.read(magic, sizeof(magic));
+            return _is_magic(std::string_view(magic, static_cast<size_t>(in.gcount())));
+        }
+
+        /**
+         * @brief Checks whether a journal starts with JOURNAL_MAGIC, or is cut off inside of it
+         * @param journal Content of the journal file
+         * @return True if the journal is binary
+         */
+        static bool _is_magic(const std::string_view journal) {
+            const std::string_view magic(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+            return !journal.empty() && journal.substr(0, magic.size()) == magic.substr(0, journal.size());
+        }
+
+        /**
+         * @brief Splits a journal into records
+         * @param journal Content of the journal file
+         * @param args Reused argument list
+         * @param on_record Callable taking the command, its arguments and the raw bytes of the record
+         * @note Binary journals are read up to the first record which is incomplete or fails its checksum,
+         * which is where a crash tore the journal. A torn header counts as a binary journal without records
+         */
+        template<typename F>
+        static void _parse(const std::string_view journal, std::vector<std::string_view>& args, F&& on_record) {
+            if (!_is_magic(journal)) {
+                NewlineScanner::split(journal, [&](const std::string_view line) {
+                    if (line.empty()) return;
+
+                    _split_line(line, args);
+                    on_record(static_cast<Command>(line[0]), args, line);
+                });
+
+                return;
+            }
+
+            size_t cursor = sizeof(JOURNAL_MAGIC) - 1;
+
+            while (cursor < journal.size()) {
+                const size_t start = cursor;
+                if (!_read_record(journal, cursor, args)) return;
+
+                on_record(static_cast<Command>(journal[start]), args, journal.substr(start, cursor - start));
+            }
+        }
+
+        /**
+         * @brief Splits a text record into its arguments
+         * @param line Record without its newline
+         * @param args Receives the arguments
+         */
+        static void _split_line(const std::string_view line, std::vector<std::string_view>& args) {
+            size_t cursor = 2;
+            std::string_view token;
+            args.clear();
+
+            while (_extract_token(line, cursor, token)) {
+                args.push_back(token);
+            }
+        }
+
+        /**
+         * @brief Decodes a binary record
+         * @param journal Content of the journal file
+         * @param cursor Position of the opcode, moved past the checksum
+         * @param args Receives the arguments
+         * @return False if the record is incomplete or fails its checksum
+         */
+        static bool _read_record(const std::string_view journal, size_t& cursor, std::vector<std::string_view>& args) {
+            const size_t start = cursor++;
+            uint64_t length = 0;
+            if (!_read_varint(journal, cursor, length) || journal.size() - cursor < length || journal.size() - cursor - length < 4) return false;
+
+            const size_t end = cursor + static_cast<size_t>(length);
+            uint32_t crc = 0;
+
+            for (int shift = 0; shift < 32; shift += 8) {
+                crc |= static_cast<uint32_t>(static_cast<unsigned char>(journal[end + shift / 8])) << shift;
+            }
+
+            if (crc != _crc32c(journal.substr(start, end - start))) return false;
+
+            args.clear();
+
+            while (cursor < end) {
+                uint64_t size = 0;
+                if (!_read_varint(journal, cursor, size) || end - cursor < size) return false;
+                args.push_back(journal.substr(cursor, static_cast<size_t>(size)));
+                cursor += static_cast<size_t>(size);
+            }
+
+            cursor = end + 4;
+            return true;
+        }
+
+        /**
+         * @brief Picks the records which still matter for the final state
+         * @param journal Content of the journal file
+         * @param args Reused argument list
+         * @return Whether to keep each record, in the order _parse() visits them
+         * @note Everything before the last Clear is dropped, and of several Overwrites of the same index only
+         * the last one is kept, as long as no insert or erase moved the lines in between. A Commit record is
+         * only meaningful at the very end, see FileManager::_recover_commit()
+         */
+        static std::vector<bool> _compact(const std::string_view journal, std::vector<std::string_view>& args) {
+            std::vector<bool> keep;
+            // Last Overwrite of each index, entries from before the latest structural change are stale
+            std::unordered_map<size_t, size_t> overwrites;
+            size_t segment = 0;
+            size_t clear = 0;
+            Command previous = Command::Append;
+
+            _parse(journal, args, [&](const Command command, const std::vector<std::string_view>& record_args, std::string_view) {
+                const size_t record = keep.size();
+                size_t index = 0;
+
+                // A Commit followed by anything else no longer marks the end of the journal
+                if (record > 0 && previous == Command::Commit) keep[record - 1] = false;
+
+                keep.push_back(true);
+                previous = command;
+
+                switch (command) {
+                    case Command::Append:
+                    case Command::Batch:
+                    case Command::Commit:
+                        break;
+                    case Command::Overwrite:
+                        if (record_args.size() < 2 || !_parse_number(record_args[0], index)) break;
+
+                        if (const auto [it, inserted] = overwrites.try_emplace(index, record); !inserted) {
+                            if (it->second >= segment) keep[it->second] = false;
+                            it->second = record;
+                        }
+
+                        break;
+                    case Command::Clear:
+                        clear = record;
+                        segment = record;
+                        break;
+                    default:
+                        segment = record;
+                }
+            });
+
+            std::fill(keep.begin(), keep.begin() + static_cast<std::ptrdiff_t>(clear), false);
+            return keep;
+        }
+
+        /**
+         * @brief Starts compacting the journal in the background once it outgrew the threshold
+         * @note Only the part of the journal written so far is compacted, records saved in the meantime are
+         * carried over by _finish_compaction(). Compacting again needs the journal to double in size first
+         */
+        void _start_compaction() {
+            if (_settings.compact_threshold == 0 || _compaction.valid()) return;
+
+            if (_size < _settings.compact_threshold || _size < 2 * _compacted_size) return;
+
+            _compaction_base = _size;
+            _compaction = std::async(std::launch::async, _write_compacted, _journal_path, _compact_path, _size);
+        }
+
+        /**
+         * @brief Replaces the journal with its compacted copy once the background compaction is done
+         * @param wait Whether to block until the compaction finished
+         */
+        void _finish_compaction(const bool wait) {
+            if (!_compaction.valid()) return;
+            if (!wait && _compaction.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+
+            std::error_code ec;
+
+            if (!_compaction.get()) {
+                std::filesystem::remove(_compact_path, ec);
+                return;
+            }
+
+            // Records saved while the compaction ran are appended to the copy before it replaces the journal
+            {
+                std::ifstream in(_journal_path, std::ios::binary);
+                std::ofstream out(_compact_path, std::ios::app | std::ios::binary);
+                in.seekg(static_cast<std::streamoff>(_compaction_base));
+                out << in.rdbuf();
+                out.close();
+
+                if (!out || (_durable() && !_sync_file(_compact_path))) {
+                    std::filesystem::remove(_compact_path, ec);
+                    return;
+                }
+            }
+
+#ifndef FILEMANAGER_POSIX
+            // An open stream keeps the journal from being replaced
+            _close();
+#endif
+            std::filesystem::rename(_compact_path, _journal_path, ec);
+
+            // Without a rename the journal stays open, so group commits keep syncing the same file
+            if (ec) {
+                std::filesystem::remove(_compact_path, ec);
+                return;
+            }
+
+            // The open handle still points to the replaced file
+            _close();
+
+            if (_durable()) _sync_directory(_journal_path);
+            _compacted_size = std::filesystem::file_size(_journal_path, ec);
+            ++_generation;
+        }
+
+        /**
+         * @brief Waits for a running background compaction and throws its copy away
+         */
+        void _cancel_compaction() {
+            if (!_compaction.valid()) return;
+
+            std::error_code ec;
+            _compaction.get();
+            std::filesystem::remove(_compact_path, ec);
+        }
+
+        /**
+         * @brief Writes a compacted copy of the first bytes of a journal
+         * @param journal_path Journal to compact
+         * @param compact_path File to write the copy to
+         * @param size Amount of bytes to compact, has to end at a record boundary
+         * @return True if the copy was written completely
+         * @note Runs on a background thread, so it only touches its arguments
+         */
+        static bool _write_compacted(const std::filesystem::path journal_path, const std::filesystem::path compact_path, const uint64_t size) {
+            try {
+                const MappedFile file(journal_path);
+                if (file.size() < size) return false;
+
+                const std::string_view journal(file.data(), static_cast<size_t>(size));
+                const bool binary = _is_magic(journal);
+                std::vector<std::string_view> args;
+                const std::vector<bool> keep = _compact(journal, args);
+                size_t record = 0;
+
+                std::ofstream out(compact_path, std::ios::trunc | std::ios::binary);
+                if (binary) out.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+
+                _parse(journal, args, [&](Command, const std::vector<std::string_view>&, const std::string_view raw) {
+                    if (!keep[record++]) return;
+                    out << raw;
+                    if (!binary) out << "\n";
+                });
+
+                out.close();
+                return static_cast<bool>(out);
+            }
+            catch (std::exception&) {
+                return false;
+            }
+        }
+
+        static void _append_varint(std::string& out, uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+
+            out.push_back(static_cast<char>(value));
+        }
+
+        /**
+         * @brief Decodes a little endian base 128 integer
+         * @param data Buffer to read from
+         * @param cursor Position of the first byte, moved past the integer
+         * @param value Receives the integer
+         * @return False if the buffer ends within the integer or it is too long
+         */
+        static bool _read_varint(const std::string_view data, size_t& cursor, uint64_t& value) {
+            value = 0;
+
+            for (int shift = 0; shift < 64 && cursor < data.size(); shift += 7) {
+                const auto byte = static_cast<unsigned char>(data[cursor++]);
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) return true;
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Computes the CRC32C (Castagnoli) checksum of a buffer
+         * @param data Bytes to check
+         * @return Checksum
+         * @note Uses the crc32 instruction of SSE 4.2 if the CPU has it, which keeps the checksum off the replay profile
+         */
+        [[nodiscard]] static uint32_t _crc32c(const std::string_view data) {
+#ifdef FILEMANAGER_X86
+            if (_has_sse42()) return _crc32c_sse42(data);
+#endif
+            return _crc32c_table(data);
+        }
+
+        [[nodiscard]] static uint32_t _crc32c_table(const std::string_view data) {
+            static const std::array<uint32_t, 256> table = [] {
+                std::array<uint32_t, 256> result{};
+
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t crc = i;
+
+                    for (int bit = 0; bit < 8; ++bit) {
+                        crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+                    }
+
+                    result[i] = crc;
+                }
+
+                return result;
+            }();
+
+            uint32_t crc = 0xFFFFFFFFu;
+
+            for (const char c : data) {
+                crc = table[(crc ^ static_cast<unsigned char>(c)) & 0xFF] ^ (crc >> 8);
+            }
+
+            return crc ^ 0xFFFFFFFFu;
+        }
+
+#ifdef FILEMANAGER_X86
+        FILEMANAGER_TARGET_SSE42 static uint32_t _crc32c_sse42(const std::string_view data) {
+            const char* cursor = data.data();
+            const char* const end = cursor + data.size();
+#if defined(__x86_64__) || defined(_M_X64)
+            uint64_t crc = 0xFFFFFFFFu;
+
+            for (; end - cursor >= 8; cursor += 8) {
+                uint64_t word;
+                std::memcpy(&word, cursor, sizeof(word));
+                crc = _mm_crc32_u64(crc, word);
+            }
+
+            auto result = static_cast<uint32_t>(crc);
+#else
+            uint32_t result = 0xFFFFFFFFu;
+
+            for (; end - cursor >= 4; cursor += 4) {
+                uint32_t word;
+                std::memcpy(&word, cursor, sizeof(word));
+                result = _mm_crc32_u32(result, word);
+            }
+#endif
+            for (; cursor < end; ++cursor) {
+                result = _mm_crc32_u8(result, static_cast<unsigned char>(*cursor));
+            }
+
+            return result ^ 0xFFFFFFFFu;
+        }
+
+        [[nodiscard]] static bool _has_sse42() {
+            static const bool supported = [] {
+#ifdef _MSC_VER
+                int info[4];
+                __cpuid(info, 1);
+                return (info[2] & (1 << 20)) != 0;
+#else
+                return __builtin_cpu_supports("sse4.2") != 0;
+#endif
+            }();
+
+            return supported;
+        }
+#endif
+
+        /**
+         * @brief Attempts to extract a token from a command line
+         * @param line Base command line
+         * @param offset Where to start reading the new token from, moved past it
+         * @param token Receives the token, pointing into the line
+         * @return True if a complete token was extracted
+         */
+        static bool _extract_token(const std::string_view line, size_t& offset, std::string_view& token) {
+            const size_t delimiter = line.find(COMMAND_DELIMITER, offset);
+            size_t length = 0;
+
+            // Each token has a fixed length, e.g. 11;Hello world; (11 in this case)
+            if (delimiter == std::string_view::npos || !_parse_number(line.substr(offset, delimiter - offset), length) || line.size() - delimiter - 1 <= length) {
+                return false;
+            }
+
+            token = line.substr(delimiter + 1, length);
+            offset = delimiter + 1 + length + 1;
+            return true;
+        }
+
+        /**
+         * @brief Serializes a parameter for the journal
+         * @param entry Record to append the token to
+         * @param value Text or integer to serialize
+         */
+        template <typename T>
+        void tokenize(std::string& entry, const T& value) const {
+            if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                const std::string_view text = value;
+
+                if (_binary) {
+                    _append_varint(entry, text.size());
+                    entry.append(text);
+                    return;
+                }
+
+                char digits[24];
+                const auto result = std::to_chars(std::begin(digits), std::end(digits), text.size());
+
+                entry.append(digits, result.ptr);
+                entry.push_back(COMMAND_DELIMITER);
+                entry.append(text);
+                entry.push_back(COMMAND_DELIMITER);
+            }
+            else {
+                static_assert(std::is_integral_v<T>, "journal arguments are either text or integers");
+                char digits[24];
+                const auto result = std::to_chars(std::begin(digits), std::end(digits), value);
+                tokenize(entry, std::string_view(digits, static_cast<size_t>(result.ptr - digits)));
+            }
+        }
+
+        const std::filesystem::path _journal_path;
+        const std::filesystem::path _compact_path;
+        const std::filesystem::path _retired_path;
+        const Settings _settings;
+        bool _binary;
+        uint64_t _compacted_size = 0;
+        uint64_t _compaction_base = 0;
+        std::future<bool> _compaction;
+#ifdef FILEMANAGER_POSIX
+        int _file = -1;
+#else
+        std::ofstream _file;
+#endif
+        // Size of the journal file, known while it is open
+        uint64_t _size = 0;
+        // Records taken out of the pending buffer while they are written, keeps its capacity between flushes
+        std::string _writing;
+        // Bytes of the journal which are known to be on disk
+        uint64_t _synced = 0;
+        // Whether a thread is currently syncing for a group commit
+        bool _syncing = false;
+        // Counts how often the journal file was replaced, which makes older syncs meaningless
+        uint64_t _generation = 0;
+        // Guards the file and everything above, so several threads can save at once
+        std::mutex _io_mutex;
+        std::condition_variable _synced_condition;
+
+        std::string _pending;
+        size_t _pending_records = 0;
+        size_t _pending_pops = 0;
+        bool _outdated = false;
+        // Time the oldest unsaved record was made, only tracked if the flush policy limits the age
+        std::chrono::steady_clock::time_point _outdated_since;
+        bool _flush_requested = false;
+        // Whether the background flusher failed, the records then wait for the next save
+        bool _flush_failed = false;
+        bool _stopping = false;
+        // Guards the format and everything since _pending, held only briefly so recording never waits for the disk
+        std::mutex _mutex;
+        std::condition_variable _flush_condition;
+        std::thread _flusher;
+    };
+
+    class MappedFile {
+    public:
+        /**
+         * @brief Maps the given file read-only into memory
+         * @param path File to map
+         * @note Falls back to reading the file into a private buffer on platforms without mmap
+         */
+        explicit MappedFile(const std::filesystem::path& path) {
+#ifdef FILEMANAGER_POSIX
+            const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) throw std::runtime_error("could not open file");
+
+            struct stat info {};
+            if (::fstat(fd, &info) != 0) {
+                ::close(fd);
+                throw std::runtime_error("could not stat file");
+            }
+
+            _size = static_cast<size_t>(info.st_size);
+
+            if (_size > 0) {
+                void* address = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (address == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("could not map file");
+                }
+
+                _data = static_cast<const char*>(address);
+            }
+
+            // The mapping keeps the file alive on its own, even after _consolidate() renames over it
+            ::close(fd);
+#else
+            std::ifstream in(path, std::ios::binary);
+            if (!in.is_open()) throw std::runtime_error("could not open file");
+
+            _size = static_cast<size_t>(std::filesystem::file_size(path));
+            _buffer.reset(new char[_size > 0 ? _size : 1]);
+            in.read(_buffer.get(), static_cast<std::streamsize>(_size));
+            _data = _buffer.get();
+#endif
+        }
+
+        ~MappedFile() {
+#ifdef FILEMANAGER_POSIX
+            if (_data != nullptr) {
+                ::munmap(const_cast<char*>(_data), _size);
+            }
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        [[nodiscard]] const char* data() const {
+            return _data;
+        }
+
+        [[nodiscard]] size_t size() const {
+            return _size;
+        }
+
+        /**
+         * @brief Checks whether a line points into this mapping
+         * @param line Line to check
+         * @return True if the line's bytes belong to the mapping
+         */
+        [[nodiscard]] bool contains(const std::string_view line) const {
+            return _data != nullptr && line.data() >= _data && line.data() + line.size() <= _data + _size;
+        }
+
+    private:
+        const char* _data = nullptr;
+        size_t _size = 0;
+#ifndef FILEMANAGER_POSIX
+        std::unique_ptr<char[]> _buffer;
+#endif
+    };
+
+    class LineArena {
+    public:
+        /**
+         * @brief Copies a line into the arena
+         * @param text Line to copy
+         * @return View of the copied line, stable until clear() is called
+         * @note Lines are packed back to back into large blocks. Lines bigger than a quarter
+         * of ARENA_BLOCK_SIZE get a dedicated block so they don't waste the rest of the current one
+         */
+        std::string_view store(const std::string_view text) {
+            // Stored lines never have a null data pointer, that is reserved for paged out lines
+            if (text.empty()) return {"", 0};
+
+            if (text.size() > _remaining) {
+                if (text.size() > ARENA_BLOCK_SIZE / 4) {
+                    char* block = _blocks.emplace_back(new char[text.size()]).get();
+                    std::memcpy(block, text.data(), text.size());
+                    _used += text.size();
+                    return {block, text.size()};
+                }
+
+                _cursor = _blocks.emplace_back(new char[ARENA_BLOCK_SIZE]).get();
+                _remaining = ARENA_BLOCK_SIZE;
+            }
+
+            char* destination = _cursor;
+            _used += text.size();
+            std::memcpy(destination, text.data(), text.size());
+
+            _cursor += text.size();
+            _remaining -= text.size();
+            return {destination, text.size()};
+        }
+
+        /**
+         * @brief Reserves a dedicated block for raw bytes which are split into lines later on
+         * @param size Amount of bytes to reserve
+         * @return Start of the block, stable until clear() is called
+         */
+        char* allocate(const size_t size) {
+            _used += size;
+            return _blocks.emplace_back(new char[size > 0 ? size : 1]).get();
+        }
+
+        /**
+         * @brief Marks a previously stored line as unused
+         * @param text Line which is no longer referenced
+         * @note The bytes are only reclaimed once the owner rebuilds the arena
+         */
+        void release(const std::string_view text) {
+            _garbage += text.size();
+        }
+
+        /**
+         * @brief Checks whether enough bytes are unused to make a rebuild worthwhile
+         * @return True if at least half of the stored bytes and one whole block are garbage
+         */
+        [[nodiscard]] bool fragmented() const {
+            return _garbage >= ARENA_BLOCK_SIZE && _garbage * 2 >= _used;
+        }
+
+        /**
+         * @brief Shares ownership of every block
+         * @return Blocks holding the stored lines, they stay alive even after clear() or a move of the arena
+         */
+        [[nodiscard]] std::vector<std::shared_ptr<char[]>> blocks() const {
+            return _blocks;
+        }
+
+        /**
+         * @brief Releases every block, invalidating all views handed out so far
+         */
+        void clear() {
+            _blocks.clear();
+            _cursor = nullptr;
+            _remaining = 0;
+            _used = 0;
+            _garbage = 0;
+        }
+
+    private:
+        // Shared so a snapshot of consolidate_async() keeps them alive while the arena moves on
+        std::vector<std::shared_ptr<char[]>> _blocks;
+        char* _cursor = nullptr;
+        size_t _remaining = 0;
+        size_t _used = 0;
+        size_t _garbage = 0;
+    };
+
+    /**
+     * @brief Sequence of line ids with O(log n) positional access, insertion and erasure
+     * @note Ids are kept in chunks of up to 2 * ORDER_CHUNK_SIZE elements. A Fenwick tree over
+     * the chunk sizes finds the chunk holding a position, the chunk itself is a plain vector.
+     * Erasing the first id only advances a head offset, which makes draining the sequence O(1) per id.
+     * Runs of consecutive ids, as left by reset() and appending, aren't stored until a chunk is modified
+     */
+    class LineOrder {
+        /**
+         * @brief Ids of a chunk, either stored or the run first to first + count - 1
+         */
+        struct Chunk {
+            std::vector<size_t> ids;
+            size_t first = 0;
+            size_t count = 0;
+
+            [[nodiscard]] size_t size() const {
+                return count + ids.size();
+            }
+
+            [[nodiscard]] size_t operator[](const size_t offset) const {
+                return count > 0 ? first + offset : ids[offset];
+            }
+
+            /**
+             * @brief Stores the ids of a run, so they can be modified one by one
+             * @return Stored ids
+             */
+            std::vector<size_t>& materialize() {
+                if (count > 0) {
+                    ids.resize(count);
+                    std::iota(ids.begin(), ids.end(), first);
+                    count = 0;
+                }
+
+                return ids;
+            }
+        };
+
+    public:
+        class const_iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = size_t;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const size_t*;
+            using reference = size_t;
+
+            const_iterator() = default;
+
+            const_iterator(const LineOrder* order, const size_t chunk, const size_t offset) :
+                _order(order),
+                _chunk(chunk),
+                _offset(offset)
+            {}
+
+            reference operator*() const {
+                return _order->_chunks[_chunk][_offset];
+            }
+
+            const_iterator& operator++() {
+                if (++_offset == _order->_chunks[_chunk].size()) {
+                    ++_chunk;
+                    _offset = 0;
+                }
+
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                const_iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            bool operator==(const const_iterator& other) const {
+                return _chunk == other._chunk && _offset == other._offset;
+            }
+
+            bool operator!=(const const_iterator& other) const {
+                return !(*this == other);
+            }
+
+        private:
+            const LineOrder* _order = nullptr;
+            size_t _chunk = 0;
+            size_t _offset = 0;
+        };
+
+        [[nodiscard]] const_iterator begin() const {
+            return {this, _first, _head};
+        }
+
+        [[nodiscard]] const_iterator end() const {
+            return {this, _chunks.size(), 0};
+        }
+
+        /**
+         * @brief Returns an iterator pointing at a position
+         * @param position Position inside the sequence, size() returns end()
+         */
+        [[nodiscard]] const_iterator iterator_at(const size_t position) const {
+            if (position == 0) return begin();
+            if (position >= _size) return end();
+
+            const auto [chunk, offset] = _locate(position);
+            return {this, chunk, offset};
+        }
+
+        /**
+         * @brief Rebuilds the chunk index ahead of time, so following lookups only read and can run concurrently
+         */
+        void prepare() const {
+            if (_stale) _rebuild();
+        }
+
+        [[nodiscard]] size_t size() const {
+            return _size;
+        }
+
+        [[nodiscard]] bool empty() const {
+            return _size == 0;
+        }
+
+        [[nodiscard]] size_t front() const {
+            return _chunks[_first][_head];
+        }
+
+        [[nodiscard]] size_t back() const {
+            return _chunks.back()[_chunks.back().size() - 1];
+        }
+
+        /**
+         * @brief Returns the id at a position
+         * @param position Position inside the sequence, has to be smaller than size()
+         * @return Id at the given position
+         */
+        [[nodiscard]] size_t operator[](const size_t position) const {
+            if (position == 0) return front();
+
+            const auto [chunk, offset] = _locate(position);
+            return _chunks[chunk][offset];
+        }
+
+        /**
+         * @brief Reserves room for the chunks needed by the given amount of ids
+         * @param count Expected amount of ids
+         */
+        void reserve(const size_t count) {
+            _chunks.reserve(count / ORDER_CHUNK_SIZE + 1);
+        }
+
+        void push_back(const size_t id) {
+            // Drained sequences start over, so nothing is appended to a popped chunk
+            if (_size == 0) clear();
+
+            if (_chunks.empty() || _chunks.back().size() >= ORDER_CHUNK_SIZE) {
+                _chunks.emplace_back();
+                _stale = true;
+            }
+
+            Chunk& chunk = _chunks.back();
+
+            if (chunk.size() == 0) {
+                chunk.first = id;
+                chunk.count = 1;
+            }
+            else if (chunk.count > 0 && id == chunk.first + chunk.count) {
+                ++chunk.count;
+            }
+            else {
+                chunk.materialize().push_back(id);
+            }
+
+            ++_size;
+
+            if (!_stale) _add(_chunks.size() - 1, 1);
+        }
+
+        /**
+         * @brief Inserts an id, shifting later ids back
+         * @param position Where to insert, may be equal to size()
+         * @param id Id to insert
+         */
+        void insert(const size_t position, const size_t id) {
+            if (position == _size) {
+                push_back(id);
+                return;
+            }
+
+            const auto [chunk, offset] = _locate(position);
+            auto& ids = _chunks[chunk].materialize();
+            ids.insert(ids.begin() + static_cast<std::ptrdiff_t>(offset), id);
+            ++_size;
+
+            if (ids.size() < 2 * ORDER_CHUNK_SIZE) {
+                _add(chunk, 1);
+                return;
+            }
+
+            // Full chunks are split in half, which shifts every later chunk
+            Chunk upper;
+            upper.ids.assign(ids.begin() + ORDER_CHUNK_SIZE, ids.end());
+            ids.resize(ORDER_CHUNK_SIZE);
+            _chunks.insert(_chunks.begin() + static_cast<std::ptrdiff_t>(chunk) + 1, std::move(upper));
+            _stale = true;
+
+            // The popped head might now fill the whole lower half
+            if (chunk == _first && _head >= ORDER_CHUNK_SIZE) {
+                _head -= ORDER_CHUNK_SIZE;
+                ++_first;
+            }
+        }
+
+        /**
+         * @brief Erases the id at a position, shifting later ids down
+         * @param position Position to erase, has to be smaller than size()
+         */
+        void erase(const size_t position) {
+            if (position == 0) {
+                pop_front();
+                return;
+            }
+
+            const auto [chunk, offset] = _locate(position);
+            auto& ids = _chunks[chunk].materialize();
+            ids.erase(ids.begin() + static_cast<std::ptrdiff_t>(offset));
+            --_size;
+
+            if (chunk == _first && ids.size() == _head) {
+                _add(chunk, -1);
+                _advance();
+                return;
+            }
+
+            if (ids.empty()) {
+                _chunks.erase(_chunks.begin() + static_cast<std::ptrdiff_t>(chunk));
+                _stale = true;
+                return;
+            }
+
+            // Small chunks are merged into their successor to keep the chunk count proportional to the size
+            if (ids.size() < ORDER_CHUNK_SIZE / 4 && chunk + 1 < _chunks.size() && ids.size() + _chunks[chunk + 1].size() <= ORDER_CHUNK_SIZE) {
+                const auto& next = _chunks[chunk + 1].materialize();
+                ids.insert(ids.end(), next.begin(), next.end());
+                _chunks.erase(_chunks.begin() + static_cast<std::ptrdiff_t>(chunk) + 1);
+                _stale = true;
+                return;
+            }
+
+            _add(chunk, -1);
+        }
+
+        /**
+         * @brief Erases several ranges of positions in a single pass
+         * @param ranges Sorted, non-overlapping [begin, end) ranges of positions
+         * @note Chunks without erased ids are moved over untouched, the others are filtered in place.
+         * Small chunks are merged with their predecessor, and the popped head is dropped as well
+         */
+        void erase(const std::vector<std::pair<size_t, size_t>>& ranges) {
+            if (ranges.empty()) return;
+
+            std::vector<Chunk> chunks;
+            chunks.reserve(_chunks.size() - _first);
+            auto range = ranges.begin();
+            size_t position = 0;
+
+            for (size_t chunk = _first; chunk < _chunks.size(); ++chunk) {
+                Chunk& current = _chunks[chunk];
+                const size_t skip = chunk == _first ? _head : 0;
+                const size_t end = position + current.size() - skip;
+
+                while (range != ranges.end() && range->second <= position) ++range;
+
+                if (skip > 0 || (range != ranges.end() && range->first < end)) {
+                    auto& ids = current.materialize();
+                    size_t kept = 0;
+
+                    for (size_t i = skip; i < ids.size(); ++i, ++position) {
+                        while (range != ranges.end() && range->second <= position) ++range;
+                        if (range != ranges.end() && range->first <= position) continue;
+                        ids[kept++] = ids[i];
+                    }
+
+                    _size -= ids.size() - skip - kept;
+                    ids.resize(kept);
+                }
+
+                position = end;
+                if (current.size() == 0) continue;
+
+                if (!chunks.empty() && (current.size() < ORDER_CHUNK_SIZE / 4 || chunks.back().size() < ORDER_CHUNK_SIZE / 4) && chunks.back().size() + current.size() <= ORDER_CHUNK_SIZE) {
+                    const auto& ids = current.materialize();
+                    auto& previous = chunks.back().materialize();
+                    previous.insert(previous.end(), ids.begin(), ids.end());
+                }
+                else {
+                    chunks.push_back(std::move(current));
+                }
+            }
+
+            _chunks = std::move(chunks);
+            _first = 0;
+            _head = 0;
+            _popped = 0;
+            _stale = true;
+        }
+
+        /**
+         * @brief Erases the first id without shifting any other id
+         */
+        void pop_front() {
+            ++_head;
+            ++_popped;
+            --_size;
+
+            if (_head == _chunks[_first].size()) {
+                _advance();
+            }
+        }
+
+        void clear() {
+            _chunks.clear();
+            _tree.clear();
+            _size = 0;
+            _first = 0;
+            _head = 0;
+            _popped = 0;
+            _stale = false;
+        }
+
+        /**
+         * @brief Replaces the content with the ids 0 to count - 1
+         * @param count Amount of ids
+         * @note Only the bounds of each chunk are stored, the ids themselves once a chunk is modified
+         */
+        void reset(const size_t count) {
+            clear();
+            reserve(count);
+
+            for (size_t id = 0; id < count; id += ORDER_CHUNK_SIZE) {
+                Chunk& chunk = _chunks.emplace_back();
+                chunk.first = id;
+                chunk.count = std::min<size_t>(ORDER_CHUNK_SIZE, count - id);
+            }
+
+            _size = count;
+            _stale = true;
+        }
+
+    private:
+        /**
+         * @brief Finds the chunk holding a position
+         * @param position Position inside the sequence
+         * @return Chunk index and offset inside that chunk
+         */
+        [[nodiscard]] std::pair<size_t, size_t> _locate(size_t position) const {
+            if (_stale) _rebuild();
+
+            // Popped ids are still counted by the tree, they are skipped by shifting the position
+            position += _popped;
+            size_t chunk = 0;
+            size_t step = 1;
+
+            while (step * 2 <= _chunks.size()) {
+                step *= 2;
+            }
+
+            for (; step > 0; step /= 2) {
+                if (chunk + step <= _chunks.size() && _tree[chunk + step] <= position) {
+                    chunk += step;
+                    position -= _tree[chunk];
+                }
+            }
+
+            return {chunk, position};
+        }
+
+        /**
+         * @brief Moves past the fully popped first chunk, dropping dead chunks once they make up half of all chunks
+         */
+        void _advance() {
+            ++_first;
+            _head = 0;
+
+            if (_first * 2 < _chunks.size()) return;
+
+            _chunks.erase(_chunks.begin(), _chunks.begin() + static_cast<std::ptrdiff_t>(_first));
+            _first = 0;
+            _popped = 0;
+            _stale = true;
+        }
+
+        void _add(const size_t chunk, const std::ptrdiff_t delta) {
+            for (size_t i = chunk + 1; i < _tree.size(); i += i & (~i + 1)) {
+                _tree[i] = static_cast<size_t>(static_cast<std::ptrdiff_t>(_tree[i]) + delta);
+            }
+        }
+
+        void _rebuild() const {
+            _tree.assign(_chunks.size() + 1, 0);
+
+            for (size_t i = 1; i < _tree.size(); ++i) {
+                _tree[i] += _chunks[i - 1].size();
+
+                if (const size_t parent = i + (i & (~i + 1)); parent < _tree.size()) {
+                    _tree[parent] += _tree[i];
+                }
+            }
+
+            _stale = false;
+        }
+
+        std::vector<Chunk> _chunks;
+        mutable std::vector<size_t> _tree;
+        mutable bool _stale = false;
+        size_t _size = 0;
+        // Chunks before _first and the first _head ids of chunk _first were popped
+        size_t _first = 0;
+        size_t _head = 0;
+        size_t _popped = 0;
+    };
+
+    /**
+     * @brief Leading bytes of the sidecar index, followed by one 64 bit start offset per line
+     */
+    struct IndexHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t file_size;
+        int64_t modified;
+        uint64_t lines;
+    };
+
+    class IndexWriter {
+    public:
+        /**
+         * @brief Starts a new sidecar index, truncating the previous one
+         * @param path Where to write the sidecar
+         * @note The header is written last, so an unfinished sidecar is never mistaken for a valid one
+         */
+        explicit IndexWriter(std::filesystem::path path) :
+            _path(std::move(path)),
+            _out(_path, std::ios::trunc | std::ios::binary)
+        {
+            const IndexHeader header {};
+            _out.write(reinterpret_cast<const char*>(&header), sizeof(IndexHeader));
+            _offsets.reserve(SCAN_BLOCK_SIZE / sizeof(uint64_t));
+        }
+
+        /**
+         * @brief Continues a sidecar which is still valid, keeping the offsets it already holds
+         * @param path Where the sidecar is located
+         * @param lines Amount of offsets the sidecar already holds
+         */
+        IndexWriter(std::filesystem::path path, const uint64_t lines) :
+            _path(std::move(path)),
+            _out(_path, std::ios::in | std::ios::out | std::ios::binary),
+            _lines(lines)
+        {
+            const IndexHeader header {};
+            _out.write(reinterpret_cast<const char*>(&header), sizeof(IndexHeader));
+            _out.seekp(static_cast<std::streamoff>(sizeof(IndexHeader) + lines * sizeof(uint64_t)));
+            _offsets.reserve(SCAN_BLOCK_SIZE / sizeof(uint64_t));
+        }
+
+        ~IndexWriter() {
+            if (_finished) return;
+
+            _out.close();
+            std::error_code ec;
+            std::filesystem::remove(_path, ec);
+        }
+
+        IndexWriter(const IndexWriter&) = delete;
+        IndexWriter& operator=(const IndexWriter&) = delete;
+
+        /**
+         * @brief Adds the start offset of the next line
+         * @param offset Byte offset of the line inside the file
+         */
+        void add(const uint64_t offset) {
+            _offsets.push_back(offset);
+            ++_lines;
+
+            if (_offsets.size() == _offsets.capacity()) {
+                _flush();
+            }
+        }
+
+        /**
+         * @brief Completes the sidecar, it is removed again if anything went wrong
+         * @param file_size Size of the indexed file
+         * @param modified Modification time of the indexed file
+         */
+        void finish(const uint64_t file_size, const int64_t modified) {
+            _flush();
+
+            IndexHeader header {};
+            std::memcpy(header.magic, "FMIX", sizeof(header.magic));
+            header.version = INDEX_FORMAT_VERSION;
+            header.file_size = file_size;
+            header.modified = modified;
+            header.lines = _lines;
+
+            _out.seekp(0);
+            _out.write(reinterpret_cast<const char*>(&header), sizeof(IndexHeader));
+            _out.close();
+            _finished = static_cast<bool>(_out);
+
+            // A continued sidecar might have held more lines than it does now
+            std::error_code ec;
+            std::filesystem::resize_file(_path, sizeof(IndexHeader) + _lines * sizeof(uint64_t), ec);
+            _finished = _finished && !ec;
+        }
+
+        [[nodiscard]] uint64_t size() const {
+            return _lines;
+        }
+
+    private:
+        void _flush() {
+            _out.write(reinterpret_cast<const char*>(_offsets.data()), static_cast<std::streamsize>(_offsets.size() * sizeof(uint64_t)));
+            _offsets.clear();
+        }
+
+        const std::filesystem::path _path;
+        std::ofstream _out;
+        std::vector<uint64_t> _offsets;
+        uint64_t _lines = 0;
+        bool _finished = false;
+    };
+
+    /**
+     * @brief Writes lines into a file by gathering them into large blocks
+     * @note Lines which don't fit into a block of their own are written directly instead of being copied
+     */
+    class BlockWriter {
+    public:
+        /**
+         * @param path File to write
+         * @param append Whether to write behind the current end of the file instead of truncating it
+         * @param expected Amount of bytes which will be written, 0 if unknown
+         * @note The expected amount is reserved on disk up front and limits the block size for small writes
+         */
+        BlockWriter(const std::filesystem::path& path, const bool append, const uint64_t expected) :
+            _capacity(expected > 0 ? static_cast<size_t>(std::min<uint64_t>(expected, WRITE_BLOCK_SIZE)) : WRITE_BLOCK_SIZE),
+            _block(new char[_capacity])
+        {
+#ifdef FILEMANAGER_POSIX
+            _file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+#ifdef __linux__
+            // Reserving keeps the file from being extended piece by piece, its size still only grows with the written bytes
+            if (struct stat info {}; _file >= 0 && expected > 0 && ::fstat(_file, &info) == 0) {
+                ::fallocate(_file, FALLOC_FL_KEEP_SIZE, info.st_size, static_cast<off_t>(expected));
+            }
+#endif
+#else
+            _file.open(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+#endif
+        }
+
+        ~BlockWriter() {
+#ifdef FILEMANAGER_POSIX
+            if (_file >= 0) ::close(_file);
+#endif
+        }
+
+        BlockWriter(const BlockWriter&) = delete;
+        BlockWriter& operator=(const BlockWriter&) = delete;
+
+        [[nodiscard]] bool is_open() const {
+#ifdef FILEMANAGER_POSIX
+            return _file >= 0;
+#else
+            return _file.is_open();
+#endif
+        }
+
+        /**
+         * @brief Adds bytes behind everything written so far
+         * @param bytes Bytes to write
+         */
+        void write(const std::string_view bytes) {
+            if (bytes.size() > _capacity - _used) {
+                _flush();
+
+                if (bytes.size() > _capacity) {
+                    _write(bytes.data(), bytes.size());
+                    return;
+                }
+            }
+
+            std::memcpy(_block.get() + _used, bytes.data(), bytes.size());
+            _used += bytes.size();
+        }
+
+        /**
+         * @brief Adds a line followed by a newline
+         * @param line Line to write
+         */
+        void write_line(const std::string_view line) {
+            write(line);
+
+            if (_used == _capacity) _flush();
+            _block[_used++] = '\n';
+        }
+
+        /**
+         * @brief Writes the last block and closes the file
+         * @return True if every byte was written
+         */
+        [[nodiscard]] bool finish() {
+            _flush();
+
+#ifdef FILEMANAGER_POSIX
+            if (_file >= 0 && ::close(_file) != 0) _failed = true;
+            _file = -1;
+#else
+            _file.close();
+            if (!_file) _failed = true;
+#endif
+
+            return !_failed;
+        }
+
+    private:
+        void _flush() {
+            if (_used == 0) return;
+
+            _write(_block.get(), _used);
+            _used = 0;
+        }
+
+        void _write(const char* data, size_t size) {
+            if (_failed) return;
+
+#ifdef FILEMANAGER_POSIX
+            while (size > 0) {
+                const ssize_t written = ::write(_file, data, size);
+
+                if (written < 0 && errno == EINTR) continue;
+
+                // Writing nothing at all would retry forever
+                if (written <= 0) {
+                    _failed = true;
+                    return;
+                }
+
+                data += written;
+                size -= static_cast<size_t>(written);
+            }
+#else
+            _file.write(data, static_cast<std::streamsize>(size));
+            if (!_file) _failed = true;
+#endif
+        }
+
+#ifdef FILEMANAGER_POSIX
+        int _file = -1;
+#else
+        std::ofstream _file;
+#endif
+        const size_t _capacity;
+        std::unique_ptr<char[]> _block;
+        size_t _used = 0;
+        bool _failed = false;
+    };
+
+    /**
+     * @brief PAGE_LINES consecutive lines of the file which are loaded and evicted together
+     */
+    struct Page {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        std::unique_ptr<char[]> buffer;
+        std::vector<std::string_view> lines;
+        uint64_t last_used = 0;
+    };
+
+    /**
+     * @brief Lines written by consolidate_async(), together with shared ownership of the memory they point into
+     */
+    struct Snapshot {
+        std::vector<std::string_view> lines;
+        std::vector<std::shared_ptr<char[]>> blocks;
+        std::shared_ptr<MappedFile> mapping;
+    };
+
+public:
+    /**
+     * @brief Controls how the file is brought into memory on construction
+     */
+    enum class LoadMode {
+        // Reads every line into owned memory
+        Stream,
+        // Maps the file and only copies lines once they are modified
+        Mapped,
+        // Loads blocks of PAGE_LINES lines on demand and evicts unused ones to stay within the memory budget
+        Paged
+    };
+
+    /**
+     * @brief Encoding of the journal file
+     */
+    enum class JournalFormat {
+        // One human readable record per line
+        Text,
+        // Length prefixed records with a checksum, allows any byte inside of lines and replays faster
+        Binary
+    };
+
+    /**
+     * @brief Controls how far saved changes are pushed to the disk before a call returns
+     */
+    enum class Durability {
+        // Leaves writing back to the operating system, saved changes survive a crash of the process but not of the system
+        None,
+        // Every write to the journal is followed by fdatasync
+        DataSync,
+        // save() waits for an fdatasync which is shared by every thread saving within the group commit window
+        GroupCommit
+    };
+
+    /**
+     * @brief Limits for the journal records which are kept in memory before they are written
+     * @note Whichever limit is reached first writes all of them, 0 disables a limit. save() always writes them
+     */
+    struct FlushPolicy {
+        // Amount of records, merged erases of the first line count separately
+        size_t max_records = JOURNAL_FLUSH_THRESHOLD;
+        // Encoded size of the records
+        size_t max_bytes = 0;
+        // Time since the oldest record was made, checked whenever another one is made or by the background flusher
+        std::chrono::milliseconds max_age = std::chrono::milliseconds(0);
+    };
+
+    struct Options {
+        LoadMode load_mode = LoadMode::Stream;
+        // Threads used to index line boundaries, files smaller than SCAN_BLOCK_SIZE per thread use fewer
+        size_t load_threads = 1;
+        // Keeps a binary line index next to the file, so unchanged files are reopened without a scan
+        bool index_sidecar = false;
+        // Upper bound for the bytes of loaded pages in LoadMode::Paged, modified lines aren't counted
+        size_t memory_budget = PAGE_MEMORY_BUDGET;
+        // Format of newly created journals, existing journals of either format are always readable
+        JournalFormat journal_format = JournalFormat::Text;
+        // Journal size in bytes which starts compacting it in the background, 0 disables it
+        uint64_t journal_compact_threshold = 0;
+        // Whether saves are synced to the disk, any policy but None also syncs rewrites of the file
+        Durability durability = Durability::None;
+        // Time a group commit waits for other threads to save before syncing
+        std::chrono::microseconds group_commit_window = std::chrono::microseconds(100);
+        // When records are written to the journal without calling save(), bounds how much a crash loses
+        FlushPolicy flush_policy;
+        // Writes journal records on a separate thread, so modifying calls never wait for the disk
+        bool background_flush = false;
+    };
+
+    /**
+     * @brief Read-only range over every line, yielding views instead of copies
+     * @note Obtained through lines(), the same invalidation rules as for view() apply
+     */
+    class LineRange {
+    public:
+        /**
+         * @brief Random access iterator over the lines, dereferencing to a view of the text
+         * @note Iterators address lines by position and are invalidated by any modification. Outside of
+         * LoadMode::Paged they can be used from multiple threads at once, e.g. by parallel algorithms. Paged
+         * mode loads and evicts pages while reading, which isn't thread-safe
+         */
+        class const_iterator {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = std::string_view;
+
+            const_iterator() = default;
+
+            const_iterator(const FileManager* manager, const size_t position) :
+                _manager(manager),
+                _position(position),
+                _it(manager->_index_order.iterator_at(position))
+            {}
+
+            reference operator*() const {
+                return _manager->_line(*_it);
+            }
+
+            reference operator[](const difference_type n) const {
+                return _manager->_line(_manager->_index_order[_position + static_cast<size_t>(n)]);
+            }
+
+            // Stepping forward follows the chunks directly, any other jump looks the position up again
+            const_iterator& operator++() {
+                ++_position;
+                ++_it;
+                return *this;
+            }
+
+            const_iterator operator++(int) {
+                const_iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            const_iterator& operator--() {
+                return *this -= 1;
+            }
+
+            const_iterator operator--(int) {
+                const_iterator previous = *this;
+                --*this;
+                return previous;
+            }
+
+            const_iterator& operator+=(const difference_type n) {
+                _position += static_cast<size_t>(n);
+                _it = _manager->_index_order.iterator_at(_position);
+                return *this;
+            }
+
+            const_iterator& operator-=(const difference_type n) {
+                return *this += -n;
+            }
+
+            friend const_iterator operator+(const_iterator it, const difference_type n) {
+                return it += n;
+            }
+
+            friend const_iterator operator+(const difference_type n, const_iterator it) {
+                return it += n;
+            }
+
+            friend const_iterator operator-(const_iterator it, const difference_type n) {
+                return it -= n;
+            }
+
+            friend difference_type operator-(const const_iterator& a, const const_iterator& b) {
+                return static_cast<difference_type>(a._position) - static_cast<difference_type>(b._position);
+            }
+
+            friend bool operator==(const const_iterator& a, const const_iterator& b) {
+                return a._position == b._position;
+            }
+
+            friend bool operator!=(const const_iterator& a, const const_iterator& b) {
+                return a._position != b._position;
+            }
+
+            friend bool operator<(const const_iterator& a, const const_iterator& b) {
+                return a._position < b._position;
+            }
+
+            friend bool operator>(const const_iterator& a, const const_iterator& b) {
+                return a._position > b._position;
+            }
+
+            friend bool operator<=(const const_iterator& a, const const_iterator& b) {
+                return a._position <= b._position;
+            }
+
+            friend bool operator>=(const const_iterator& a, const const_iterator& b) {
+                return a._position >= b._position;
+            }
+
+        private:
+            const FileManager* _manager = nullptr;
+            size_t _position = 0;
+            LineOrder::const_iterator _it;
+        };
+
+        explicit LineRange(const FileManager* manager) :
+            _manager(manager)
+        {}
+
+        [[nodiscard]] const_iterator begin() const {
+            return _manager->begin();
+        }
+
+        [[nodiscard]] const_iterator end() const {
+            return _manager->end();
+        }
+
+        [[nodiscard]] size_t size() const {
+            return _manager->size();
+        }
+
+        [[nodiscard]] bool empty() const {
+            return _manager->empty();
+        }
+
+    private:
+        const FileManager* _manager;
+    };
+
+    using const_iterator = LineRange::const_iterator;
+
+    explicit FileManager(std::filesystem::path file_path) :
+        FileManager(std::move(file_path), Options{})
+    {}
+
+    FileManager(std::filesystem::path file_path, const Options options) :
+        _journal(file_path.parent_path() / (file_path.stem().string() + "_journal" + file_path.extension().string()), _journal_settings(options)),
+        _root_path(std::move(file_path)),
+        _index_path(std::filesystem::path(_root_path) += ".idx"),
+        _snapshot_path(std::filesystem::path(_root_path) += ".snapshot"),
+        _options(options)
+    {
+        if (std::filesystem::path tmp_path = _root_path ; std::filesystem::exists(tmp_path.replace_extension(".tmp"))) {
+            std::filesystem::remove(tmp_path);
+        }
+
+        // The snapshot file of an interrupted consolidate_async() only disappears by replacing the root path,
+        // the retired journal segment is part of the file then. Otherwise it still has to be replayed
+        if (!std::filesystem::exists(_snapshot_path)) {
+            _journal.discard_retired();
+        }
+        else if (!_journal.retired()) {
+            std::filesystem::remove(_snapshot_path);
+        }
+
+        if (_journal.exists()) {
+            _recover_commit();
+        }
+
+        if (std::filesystem::exists(_root_path)) {
+            _init_cache();
+            _trailing_newline = _ends_with_newline();
+        }
+
+        _persisted_lines = _index_order.size();
+
+        if (_journal.exists()) {
+            _journal.replay([this](const Command command, const std::vector<std::string_view>& args) {
+                _execute_command(command, args);
+            });
+            _consolidate();
+        }
+    }
+
+    ~FileManager() {
+        try {
+            _finish_consolidation();
+            _consolidate();
+        }
+        catch (std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    /**
+     * @brief Returns a copy of the text at the specified index
+     * @param index Line you want to read
+     * @return Copy of the text at the given index
+     */
+    [[nodiscard]] std::string read(const size_t index) const {
+        if (index >= _index_order.size()) throw std::out_of_range("index out of range");
+        return std::string(_line(_index_order[index]));
+    }
+
+    /**
+     * @brief Returns a copy of the first line of the file
+     * @return Copy of the first line
+     */
+    [[nodiscard]] std::string first() const {
+        if (_index_order.empty()) throw std::out_of_range("file is empty");
+        return std::string(_line(_index_order.front()));
+    }
+
+    /**
+     * @brief Returns a copy of the last line of the file
+     * @return Copy of the last line
+     */
+    [[nodiscard]] std::string last() const {
+        if (_index_order.empty()) throw std::out_of_range("file is empty");
+        return std::string(_line(_index_order.back()));
+    }
+
+    /**
+     * @brief Copies every line of the file
+     * @return Copy of every line
+     */
+    [[nodiscard]] std::vector<std::string> all() const {
+        std::vector<std::string> result;
+        result.reserve(_index_order.size());
+
+        for (const auto index : _index_order) {
+            result.emplace_back(_line(index));
+        }
+
+        return result;
+    }
+
+    /**
+     * @brief Returns the text at the specified index without copying it
+     * @param index Line you want to read
+     * @return View of the text at the given index
+     * @note The view stays valid until the line is overwritten or erased, or until clear() is called. Erasing
+     * or overwriting other lines may compact the memory as well, so views should not be held across any
+     * modification except append() and insert(). In LoadMode::Paged, reading another line may evict the page
+     * the view points into, and saving to the file drops every page, so views only last until the next call
+     */
+    [[nodiscard]] std::string_view view(const size_t index) const {
+        if (index >= _index_order.size()) throw std::out_of_range("index out of range");
+        return _line(_index_order[index]);
+    }
+
+    /**
+     * @brief Returns the first line of the file without copying it
+     * @return View of the first line, invalidated like the result of view()
+     */
+    [[nodiscard]] std::string_view front_view() const {
+        if (_index_order.empty()) throw std::out_of_range("file is empty");
+        return _line(_index_order.front());
+    }
+
+    /**
+     * @brief Returns the last line of the file without copying it
+     * @return View of the last line, invalidated like the result of view()
+     */
+    [[nodiscard]] std::string_view back_view() const {
+        if (_index_order.empty()) throw std::out_of_range("file is empty");
+        return _line(_index_order.back());
+    }
+
+    /**
+     * @brief Returns a range over every line which yields views instead of copies
+     * @return Range over all lines, its iterators are invalidated by any modification
+     */
+    [[nodiscard]] LineRange lines() const {
+        return LineRange(this);
+    }
+
+    /**
+     * @brief Returns an iterator to the first line
+     * @return Random access iterator yielding views, invalidated by any modification
+     */
+    [[nodiscard]] const_iterator begin() const {
+        // Iterators may be handed to other threads, so the position lookup must not rebuild anything lazily
+        _index_order.prepare();
+        return {this, 0};
+    }
+
+    /**
+     * @brief Returns an iterator past the last line
+     * @return Random access iterator, invalidated by any modification
+     */
+    [[nodiscard]] const_iterator end() const {
+        _index_order.prepare();
+        return {this, _index_order.size()};
+    }
+
+    /**
+     * @brief Append the given arguments to the file
+     * @param args Content to append, formatted like an std::ostream would
+     */
+    template <typename... Args>
+    void append(Args&&... args) {
+        const std::string_view text = _format(std::forward<Args>(args)...);
+        _apply_append(text);
+        _journal.record(Command::Append, text);
+    }
+
+    /**
+     * @brief Appends every element of a range as a new line
+     * @param first Iterator to the first element
+     * @param last Iterator past the last element
+     * @note Elements are formatted like the arguments of append(). The whole range is journaled as a single record
+     */
+    template <typename It>
+    void append_range(It first, const It last) {
+        const size_t begin = _cache.size();
+
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>) {
+            _reserve_lines(static_cast<size_t>(std::distance(first, last)));
+        }
+
+        for (; first != last; ++first) {
+            _apply_append(_format(*first));
+        }
+
+        _record_appended(begin);
+    }
+
+    /**
+     * @brief Appends every argument as its own line
+     * @param lines Content of the new lines, formatted like the arguments of append()
+     * @note All lines are journaled as a single record
+     */
+    template <typename... Args>
+    void append_many(Args&&... lines) {
+        const size_t begin = _cache.size();
+        _reserve_lines(sizeof...(Args));
+
+        (_apply_append(_format(std::forward<Args>(lines))), ...);
+        _record_appended(begin);
+    }
+
+    /**
+     * @brief Overwrites the specified index with the given arguments
+     * @param index Line to overwrite
+     * @param args Content to overwrite with, formatted like an std::ostream would
+     */
+    template <typename... Args>
+    void overwrite(const size_t index, Args&&... args) {
+        const std::string_view text = _format(std::forward<Args>(args)...);
+        _apply_overwrite(index, text);
+        _journal.record(Command::Overwrite, index, text);
+    }
+
+    /**
+     * @brief Inserts the given arguments as a new line, shifting later elements back
+     * @param index Position of the new line, size() appends it
+     * @param args Content to insert, formatted like an std::ostream would
+     */
+    template <typename... Args>
+    void insert(const size_t index, Args&&... args) {
+        const std::string_view text = _format(std::forward<Args>(args)...);
+        _apply_insert(index, text);
+        _journal.record(Command::Insert, index, text);
+    }
+
+    /**
+     * @brief Deletes a line, shifting later elements down
+     * @param index Which line to erase
+     */
+    void erase(const size_t index) {
+        _apply_erase(index);
+
+        if (index == 0) {
+            _journal.record_pop();
+        }
+        else {
+            _journal.record(Command::Erase, index);
+        }
+    }
+
+    /**
+     * @brief Deletes every line in [first, last), shifting later elements down
+     * @param first Position of the first line to erase
+     * @param last Position past the last line to erase
+     */
+    void erase_range(const size_t first, const size_t last) {
+        if (first > last || last > _index_order.size()) throw std::invalid_argument("Invalid range");
+        if (first == last) return;
+
+        const std::vector<std::pair<size_t, size_t>> ranges{{first, last}};
+        _apply_erase_ranges(ranges);
+        _record_erased(ranges);
+    }
+
+    /**
+     * @brief Deletes every line the predicate holds for, shifting later elements down
+     * @param predicate Callable taking the text of a line as std::string_view
+     * @return Amount of erased lines
+     * @note All lines are checked first and then erased in a single pass, so the predicate only sees the
+     * lines as they were before the call
+     */
+    template <typename Predicate>
+    size_t erase_if(Predicate&& predicate) {
+        std::vector<std::pair<size_t, size_t>> ranges;
+        size_t position = 0;
+        size_t erased = 0;
+
+        for (auto it = _index_order.begin(); it != _index_order.end(); ++it, ++position) {
+            if (!predicate(_line(*it))) continue;
+
+            if (!ranges.empty() && ranges.back().second == position) {
+                ++ranges.back().second;
+            }
+            else {
+                ranges.emplace_back(position, position + 1);
+            }
+
+            ++erased;
+        }
+
+        _apply_erase_ranges(ranges);
+        _record_erased(ranges);
+        return erased;
+    }
+
+    /**
+     * @brief Deletes everything
+     */
+    void clear() {
+        _apply_clear();
+        _journal.record(Command::Clear);
+    }
+
+    /**
+     * @brief Writes all changes into the file on a background thread
+     * @note Takes a snapshot of the lines and starts a new journal segment, so modifications go on while the
+     * snapshot is written. The old segment is discarded once the new file replaced the old one, if writing fails
+     * it is kept and the next consolidation rewrites the file. A previous call is waited for first, the
+     * destructor waits as well. LoadMode::Paged reads from the file while it is replaced, so it consolidates
+     * right away instead
+     */
+    void consolidate_async() {
+        _finish_consolidation();
+        if (!_needs_consolidation) return;
+
+        if (_options.load_mode == LoadMode::Paged || _journal.retired()) {
+            _consolidate();
+            return;
+        }
+
+        // The snapshot file has to exist before the journal is rotated, see the constructor. Without it, a crash
+        // would discard the retired segment, so the file is rewritten right away instead
+        std::ofstream snapshot_file(_snapshot_path, std::ios::trunc);
+        snapshot_file.close();
+
+        if (!snapshot_file || (_options.durability != Durability::None && !_sync_directory(_snapshot_path))) {
+            _consolidate();
+            return;
+        }
+
+        // Lines before _dirty_from are still exactly as they are on disk. Without a trailing newline, the last
+        // line on disk is written again, followed by the newline it is missing
+        size_t kept = std::min(_dirty_from, _persisted_lines);
+        if (kept > 0 && kept == _persisted_lines && !_trailing_newline) --kept;
+
+        const uint64_t prefix = kept > 0 ? _persisted_offset(kept) : 0;
+        auto index = std::make_shared<std::optional<IndexWriter>>();
+        _open_index(*index, kept);
+
+        Snapshot snapshot;
+        snapshot.lines.reserve(_index_order.size() - kept);
+
+        for (auto it = _index_order.iterator_at(kept); it != _index_order.end(); ++it) {
+            snapshot.lines.push_back(_line(*it));
+        }
+
+        snapshot.blocks = _arena.blocks();
+        snapshot.mapping = _mapping;
+
+        _journal.rotate();
+
+        // From here on, changes are tracked against the file as the snapshot will leave it
+        _fallback_lines = _persisted_lines;
+        _fallback_trailing_newline = _trailing_newline;
+        _persisted_lines = _index_order.size();
+        _trailing_newline = true;
+        _dirty_from = std::numeric_limits<size_t>::max();
+        _shifted_from = std::numeric_limits<size_t>::max();
+        _patched_lines.clear();
+        _needs_consolidation = false;
+
+        _consolidation = std::async(std::launch::async, [this, snapshot = std::move(snapshot), prefix, index] {
+            return _write_snapshot(snapshot, prefix, *index);
+        });
+    }
+
+    /**
+     * @brief Saves all changes
+     * @note Changes aren't saved to the main file, the journal is flushed instead
+     * to increase performance. Only touches the journal, so it may be called from multiple threads
+     * at once and while another thread modifies the file manager. With Durability::GroupCommit this
+     * lets concurrent saves share one sync. With a background flusher, waits until it wrote everything
+     * recorded before the call
+     */
+    void save() {
+        _journal.save();
+    }
+
+    [[nodiscard]] size_t size() const {
+        return _index_order.size();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return _index_order.empty();
+    }
+
+private:
+    /**
+     * @brief Initializes the cache with the content of the root path
+     */
+    void _init_cache() {
+        if (_options.index_sidecar && _load_index()) return;
+
+        if (_options.load_mode == LoadMode::Paged) {
+            _init_paged_cache();
+            return;
+        }
+
+        if (_options.load_mode == LoadMode::Mapped) {
+            _init_mapped_cache();
+        }
+        else {
+            _init_stream_cache();
+        }
+
+        // A journal means the file is rewritten right away, which creates the sidecar anyway
+        if (_options.index_sidecar && !_journal.exists()) {
+            _write_index();
+        }
+    }
+
+    /**
+     * @brief Reads every line of the root path into the arena
+     */
+    void _init_stream_cache() {
+        // Read as bytes like the other load modes, so line lengths match the file and offsets computed from them hold
+        std::ifstream in(_root_path, std::ios::binary);
+        size_t index = 0;
+
+        if (!in.is_open()) throw std::runtime_error("could not open file");
+
+        // Parallel indexing needs the whole file at once, so it is read into a single arena block
+        if (const auto file_size = std::filesystem::file_size(_root_path); _load_threads(file_size) > 1) {
+            char* data = _arena.allocate(file_size);
+            in.read(data, static_cast<std::streamsize>(file_size));
+            _index_lines(data, static_cast<size_t>(in.gcount()));
+            return;
+        }
+
+        // Reserve vector space by guessing how many lines the file has
+        if (const auto file_size = std::filesystem::file_size(_root_path); file_size > 0) {
+            const size_t estimated_rows = file_size / ESTIMATED_CHARS_PER_ROW + 1;
+            _cache.reserve(estimated_rows);
+            _index_order.reserve(estimated_rows);
+        }
+
+        NewlineScanner::split(in, [&](const std::string_view line) {
+            _cache.push_back(_arena.store(line));
+            _index_order.push_back(index);
+            ++index;
+        });
+    }
+
+    /**
+     * @brief Maps the root path and indexes its line boundaries without copying any text
+     */
+    void _init_mapped_cache() {
+        _mapping = std::make_shared<MappedFile>(_root_path);
+
+        if (_load_threads(_mapping->size()) > 1) {
+            _index_lines(_mapping->data(), _mapping->size());
+            return;
+        }
+
+        size_t index = 0;
+
+        if (_mapping->size() > 0) {
+            const size_t estimated_rows = _mapping->size() / ESTIMATED_CHARS_PER_ROW + 1;
+            _cache.reserve(estimated_rows);
+            _index_order.reserve(estimated_rows);
+        }
+
+        NewlineScanner::split(std::string_view(_mapping->data(), _mapping->size()), [&](const std::string_view line) {
+            _cache.push_back(line);
+            _index_order.push_back(index);
+            ++index;
+        });
+    }
+
+    /**
+     * @brief Finds the page boundaries of the root path without keeping any text in memory
+     */
+    void _init_paged_cache() {
+        std::ifstream in(_root_path, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("could not open file");
+
+        const uint64_t file_size = std::filesystem::file_size(_root_path);
+        std::unique_ptr<char[]> buffer(new char[SCAN_BLOCK_SIZE]);
+        std::vector<uint64_t> page_offsets;
+        std::optional<IndexWriter> index;
+        uint64_t position = 0;
+        size_t lines = 0;
+
+        if (_options.index_sidecar && !_journal.exists()) {
+            index.emplace(_index_path);
+        }
+
+        const auto start_line = [&](const uint64_t offset) {
+            if (lines % PAGE_LINES == 0) page_offsets.push_back(offset);
+            if (index) index->add(offset);
+            ++lines;
+        };
+
+        if (file_size > 0) {
+            start_line(0);
+        }
+
+        while (in) {
+            in.read(buffer.get(), SCAN_BLOCK_SIZE);
+            const auto count = static_cast<size_t>(in.gcount());
+            if (count == 0) break;
+
+            NewlineScanner::scan(buffer.get(), count, [&](const size_t newline) {
+                if (position + newline + 1 < file_size) {
+                    start_line(position + newline + 1);
+                }
+            });
+
+            position += count;
+        }
+
+        _rebase_pages(page_offsets, lines, file_size);
+
+        if (index) {
+            index->finish(file_size, _modified_time());
+        }
+    }
+
+    /**
+     * @brief Resets the cache so every line is served from the pages of the root path
+     * @param page_offsets Start offset of every page
+     * @param lines Amount of lines in the file
+     * @param file_size Size of the file in bytes
+     */
+    void _rebase_pages(const std::vector<uint64_t>& page_offsets, const size_t lines, const uint64_t file_size) {
+        _drop_pages();
+        _pages.resize(page_offsets.size());
+
+        for (size_t i = 0; i < page_offsets.size(); ++i) {
+            const uint64_t end = i + 1 < page_offsets.size() ? page_offsets[i + 1] : file_size;
+            _pages[i].offset = page_offsets[i];
+            _pages[i].size = end - page_offsets[i];
+        }
+
+        // Lines on disk take no room until they are overwritten, the rest of the old cache is obsolete
+        std::vector<std::string_view>().swap(_cache);
+        _arena.clear();
+        _index_order.reset(lines);
+        _paged_lines = lines;
+    }
+
+    /**
+     * @brief Forgets every page, including the ones which are currently loaded
+     */
+    void _drop_pages() {
+        _pages.clear();
+        _page_overrides.clear();
+        _resident_pages.clear();
+        _resident_bytes = 0;
+        _paged_lines = 0;
+        _page_reader.close();
+    }
+
+    /**
+     * @brief Returns a page, loading it from the root path and evicting cold pages if necessary
+     * @param page_index Which page to load
+     * @return Loaded page, valid until the next call
+     */
+    const Page& _load_page(const size_t page_index) const {
+        Page& page = _pages[page_index];
+        page.last_used = ++_page_clock;
+
+        if (page.buffer) return page;
+
+        const size_t first_line = page_index * PAGE_LINES;
+        const size_t expected_lines = std::min<size_t>(PAGE_LINES, _paged_lines - first_line);
+        const uint64_t footprint = page.size + expected_lines * sizeof(std::string_view);
+
+        // Pages are never dirty, modified lines live in the arena, so any page can be dropped
+        while (!_resident_pages.empty() && _resident_bytes + footprint > _options.memory_budget) {
+            const auto coldest = std::min_element(_resident_pages.begin(), _resident_pages.end(), [this](const size_t a, const size_t b) {
+                return _pages[a].last_used < _pages[b].last_used;
+            });
+
+            Page& victim = _pages[*coldest];
+            _resident_bytes -= victim.size + victim.lines.capacity() * sizeof(std::string_view);
+            victim.buffer.reset();
+            std::vector<std::string_view>().swap(victim.lines);
+            _resident_pages.erase(coldest);
+        }
+
+        if (!_page_reader.is_open()) {
+            _page_reader.open(_root_path, std::ios::binary);
+            if (!_page_reader.is_open()) throw std::runtime_error("could not open file");
+        }
+
+        page.buffer.reset(new char[page.size > 0 ? page.size : 1]);
+        _page_reader.clear();
+        _page_reader.seekg(static_cast<std::streamoff>(page.offset));
+        _page_reader.read(page.buffer.get(), static_cast<std::streamsize>(page.size));
+
+        page.lines.reserve(expected_lines);
+        NewlineScanner::split(std::string_view(page.buffer.get(), static_cast<size_t>(_page_reader.gcount())), [&](const std::string_view line) {
+            page.lines.push_back(line);
+        });
+
+        if (page.lines.size() != expected_lines) {
+            page.buffer.reset();
+            std::vector<std::string_view>().swap(page.lines);
+            throw std::runtime_error("file was modified outside of the file manager");
+        }
+
+        _resident_pages.push_back(page_index);
+        _resident_bytes += page.size + page.lines.capacity() * sizeof(std::string_view);
+        return page;
+    }
+
+    /**
+     * @brief Resolves the text of a line, loading its page if it is paged out
+     * @param id Position of the line inside _cache
+     * @return Text of the line, valid until the next page is loaded
+     */
+    [[nodiscard]] std::string_view _line(const size_t id) const {
+        if (id >= _paged_lines) return _cache[id - _paged_lines];
+        if (const auto it = _page_overrides.find(id); it != _page_overrides.end()) return it->second;
+        return _load_page(id / PAGE_LINES).lines[id % PAGE_LINES];
+    }
+
+    /**
+     * @brief Returns the stored text of a line, which may be replaced
+     * @param id Position of the line inside _cache, or a paged line which is about to be overwritten
+     * @return Reference to the view of the line
+     */
+    std::string_view& _slot(const size_t id) {
+        return id < _paged_lines ? _page_overrides[id] : _cache[id - _paged_lines];
+    }
+
+    /**
+     * @brief Lets go of the stored text of an erased line
+     * @param id Id of the line
+     */
+    void _forget(const size_t id) {
+        if (id >= _paged_lines) {
+            _release(_cache[id - _paged_lines]);
+            return;
+        }
+
+        if (const auto it = _page_overrides.find(id); it != _page_overrides.end()) {
+            _release(it->second);
+            _page_overrides.erase(it);
+        }
+    }
+
+    /**
+     * @brief Attempts to rebuild the cache from the sidecar index instead of scanning the file
+     * @return True if the sidecar matched the file and the cache was loaded from it
+     */
+    bool _load_index() {
+        const auto valid_header = _valid_index_header();
+        if (!valid_header) return false;
+
+        const IndexHeader header = *valid_header;
+        const MappedFile index(_index_path);
+        if (index.size() != sizeof(IndexHeader) + header.lines * sizeof(uint64_t)) return false;
+
+        const char* offsets = index.data() + sizeof(IndexHeader);
+
+        // Paged mode only needs every PAGE_LINES-th offset, which makes reopening nearly free
+        if (_options.load_mode == LoadMode::Paged) {
+            std::vector<uint64_t> page_offsets;
+            page_offsets.reserve(header.lines / PAGE_LINES + 1);
+
+            for (size_t i = 0; i < header.lines; i += PAGE_LINES) {
+                uint64_t offset;
+                std::memcpy(&offset, offsets + i * sizeof(uint64_t), sizeof(uint64_t));
+
+                if (offset >= header.file_size || (!page_offsets.empty() && offset <= page_offsets.back())) {
+                    return false;
+                }
+
+                page_offsets.push_back(offset);
+            }
+
+            _rebase_pages(page_offsets, header.lines, header.file_size);
+            return true;
+        }
+
+        const char* data;
+        size_t size;
+
+        if (_options.load_mode == LoadMode::Mapped) {
+            _mapping = std::make_shared<MappedFile>(_root_path);
+            data = _mapping->data();
+            size = _mapping->size();
+        }
+        else {
+            std::ifstream in(_root_path, std::ios::binary);
+            char* buffer = _arena.allocate(header.file_size);
+            in.read(buffer, static_cast<std::streamsize>(header.file_size));
+            data = buffer;
+            size = static_cast<size_t>(in.gcount());
+        }
+
+        const size_t end = size > 0 && data[size - 1] == '\n' ? size - 1 : size;
+        _cache.resize(header.lines);
+
+        for (size_t i = 0; i < header.lines; ++i) {
+            uint64_t start;
+            uint64_t next = end + 1;
+            std::memcpy(&start, offsets + i * sizeof(uint64_t), sizeof(uint64_t));
+
+            if (i + 1 < header.lines) {
+                std::memcpy(&next, offsets + (i + 1) * sizeof(uint64_t), sizeof(uint64_t));
+            }
+
+            // A torn or foreign sidecar falls back to a regular scan
+            if (next <= start || next - 1 > size) {
+                _cache.clear();
+                _arena.clear();
+                _mapping.reset();
+                return false;
+            }
+
+            _cache[i] = std::string_view(data + start, next - start - 1);
+        }
+
+        _index_order.reset(_cache.size());
+        return true;
+    }
+
+    /**
+     * @brief Reads the header of the sidecar index if the sidecar still describes the root path
+     * @return Header of the sidecar, empty if it is missing, malformed or stale
+     */
+    [[nodiscard]] std::optional<IndexHeader> _valid_index_header() const {
+        std::error_code ec;
+        const auto index_size = std::filesystem::file_size(_index_path, ec);
+        if (ec || index_size < sizeof(IndexHeader)) return std::nullopt;
+
+        std::ifstream in(_index_path, std::ios::binary);
+        IndexHeader header {};
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(IndexHeader))) return std::nullopt;
+
+        if (std::memcmp(header.magic, "FMIX", sizeof(header.magic)) != 0 ||
+            header.version != INDEX_FORMAT_VERSION ||
+            index_size != sizeof(IndexHeader) + header.lines * sizeof(uint64_t) ||
+            header.file_size != std::filesystem::file_size(_root_path, ec) ||
+            header.modified != _modified_time()) {
+            return std::nullopt;
+        }
+
+        return header;
+    }
+
+    /**
+     * @brief Writes the sidecar index for the current content of the root path
+     * @note Only valid while the cache matches the file, i.e. right after loading or consolidating
+     */
+    void _write_index() const {
+        std::error_code ec;
+        const uint64_t file_size = std::filesystem::file_size(_root_path, ec);
+        if (ec) return;
+
+        IndexWriter index(_index_path);
+        uint64_t offset = 0;
+
+        for (const auto id : _index_order) {
+            index.add(offset);
+            offset += _line(id).size() + 1;
+        }
+
+        index.finish(file_size, _modified_time());
+    }
+
+    /**
+     * @brief Picks the options which concern the journal
+     * @param options Options of the file manager
+     * @return Settings to construct the journal with
+     */
+    static Journal::Settings _journal_settings(const Options& options) {
+        Journal::Settings settings;
+        settings.binary = options.journal_format == JournalFormat::Binary;
+        settings.compact_threshold = options.journal_compact_threshold;
+        settings.sync_writes = options.durability == Durability::DataSync;
+        settings.group_commit = options.durability == Durability::GroupCommit;
+        settings.group_commit_window = options.group_commit_window;
+        settings.flush_records = options.flush_policy.max_records;
+        settings.flush_bytes = options.flush_policy.max_bytes;
+        settings.flush_age = options.flush_policy.max_age;
+        settings.background_flush = options.background_flush;
+        return settings;
+    }
+
+#ifdef FILEMANAGER_POSIX
+    /**
+     * @brief Flushes the data of an open file to the disk
+     * @param file Descriptor of the file
+     * @return True on success
+     */
+    static bool _sync_descriptor(const int file) {
+#ifdef __APPLE__
+        return ::fsync(file) == 0;
+#else
+        return ::fdatasync(file) == 0;
+#endif
+    }
+#endif
+
+    /**
+     * @brief Flushes a file to the disk
+     * @param path File to flush
+     * @return True on success, always true on platforms without POSIX
+     */
+    static bool _sync_file(const std::filesystem::path& path) {
+#ifdef FILEMANAGER_POSIX
+        const int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0) return false;
+
+        const bool synced = ::fsync(file) == 0;
+        return ::close(file) == 0 && synced;
+#else
+        (void)path;
+        return true;
+#endif
+    }
+
+    /**
+     * @brief Flushes the directory holding a file, which makes renaming or creating the file durable
+     * @param path File inside the directory
+     * @return True if the directory reached the disk
+     */
+    static bool _sync_directory(const std::filesystem::path& path) {
+#ifdef FILEMANAGER_POSIX
+        const std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+        const int file = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (file < 0) return false;
+
+        const bool synced = ::fsync(file) == 0;
+        ::close(file);
+        return synced;
+#else
+        (void)path;
+        return true;
+#endif
+    }
+
+    /**
+     * @brief Reads the last modification time of the root path
+     * @return Modification time in ticks of the filesystem clock, 0 if unavailable
+     */
+    [[nodiscard]] int64_t _modified_time() const {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(_root_path, ec);
+        return ec ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+    }
+
+    /**
+     * @brief Determines how many threads are worth using to index a file
+     * @param file_size Size of the file in bytes
+     * @return Configured amount of threads, limited to one per SCAN_BLOCK_SIZE bytes
+     */
+    [[nodiscard]] size_t _load_threads(const size_t file_size) const {
+        return std::max<size_t>(1, std::min(_options.load_threads, file_size / SCAN_BLOCK_SIZE));
+    }
+
+    /**
+     * @brief Indexes the line boundaries of a contiguous buffer on multiple threads
+     * @param data Buffer holding the whole file, has to outlive the cache
+     * @param size Length of the buffer
+     * @note Every thread scans its own byte range and writes the lines ending inside it straight into
+     * _cache. The first line of each range starts in an earlier range, so those are stitched afterwards
+     */
+    void _index_lines(const char* data, const size_t size) {
+        constexpr size_t none = std::numeric_limits<size_t>::max();
+        const size_t threads = _load_threads(size);
+        const size_t range = size / threads + 1;
+
+        struct Range {
+            size_t begin = 0;
+            size_t end = 0;
+            size_t newlines = 0;
+            size_t first_newline = none;
+            size_t last_newline = none;
+            size_t first_line = 0;
+        };
+
+        std::vector<Range> ranges(threads);
+
+        for (size_t i = 0; i < threads; ++i) {
+            ranges[i].begin = std::min(i * range, size);
+            ranges[i].end = std::min(ranges[i].begin + range, size);
+        }
+
+        _run_parallel(threads, [&](const size_t i) {
+            Range& part = ranges[i];
+
+            NewlineScanner::scan(data + part.begin, part.end - part.begin, [&](size_t) {
+                ++part.newlines;
+            });
+        });
+
+        size_t lines = 0;
+
+        for (auto& part : ranges) {
+            part.first_line = lines;
+            lines += part.newlines;
+        }
+
+        // Same line semantics as std::getline, only an unterminated tail adds another line
+        const bool has_tail = size > 0 && data[size - 1] != '\n';
+        _cache.resize(lines + (has_tail ? 1 : 0));
+
+        _run_parallel(threads, [&](const size_t i) {
+            Range& part = ranges[i];
+            size_t line = part.first_line;
+
+            NewlineScanner::scan(data + part.begin, part.end - part.begin, [&](const size_t offset) {
+                const size_t newline = part.begin + offset;
+
+                if (part.last_newline == none) {
+                    part.first_newline = newline;
+                }
+                else {
+                    _cache[line] = std::string_view(data + part.last_newline + 1, newline - part.last_newline - 1);
+                }
+
+                part.last_newline = newline;
+                ++line;
+            });
+        });
+
+        size_t start = 0;
+
+        for (const auto& part : ranges) {
+            if (part.newlines == 0) continue;
+            _cache[part.first_line] = std::string_view(data + start, part.first_newline - start);
+            start = part.last_newline + 1;
+        }
+
+        if (has_tail) {
+            _cache.back() = std::string_view(data + start, size - start);
+        }
+
+        _index_order.reset(_cache.size());
+    }
+
+    /**
+     * @brief Runs a task once per thread index and waits for all of them
+     * @param threads Amount of threads, the calling thread handles index 0
+     * @param task Callable taking the thread index
+     */
+    template <typename F>
+    static void _run_parallel(const size_t threads, F&& task) {
+        std::vector<std::future<void>> workers;
+        workers.reserve(threads);
+
+        for (size_t i = 1; i < threads; ++i) {
+            workers.push_back(std::async(std::launch::async, [&task, i] { task(i); }));
+        }
+
+        task(0);
+
+        for (auto& worker : workers) {
+            worker.get();
+        }
+    }
+
+    /**
+     * @brief Writes a snapshot into the root path, runs on the thread started by consolidate_async()
+     * @param snapshot Lines after the unchanged prefix of the root path
+     * @param prefix Amount of bytes at the start of the root path which are kept
+     * @param index Sidecar writer which already holds the kept lines, empty if sidecars are disabled
+     * @return True if the root path was replaced
+     * @note Only reads the snapshot, the paths and the options, and the journal calls it makes are thread-safe
+     */
+    bool _write_snapshot(const Snapshot& snapshot, const uint64_t prefix, std::optional<IndexWriter>& index) const {
+        try {
+            if (prefix > 0 && !_copy_prefix(_snapshot_path, prefix)) return false;
+
+            uint64_t expected = 0;
+
+            for (const std::string_view line : snapshot.lines) {
+                expected += line.size() + 1;
+            }
+
+            BlockWriter out(_snapshot_path, prefix > 0, expected);
+            if (!out.is_open()) return false;
+
+            uint64_t offset = prefix;
+
+            for (const std::string_view line : snapshot.lines) {
+                if (index) index->add(offset);
+
+                out.write_line(line);
+                offset += line.size() + 1;
+            }
+
+            if (!out.finish()) return false;
+            if (_options.durability != Durability::None && !_sync_file(_snapshot_path)) return false;
+
+            std::error_code ec;
+            std::filesystem::rename(_snapshot_path, _root_path, ec);
+            if (ec) return false;
+
+            if (_options.durability != Durability::None) _sync_directory(_root_path);
+            _journal.discard_retired();
+
+            if (index) {
+                index->finish(std::filesystem::file_size(_root_path, ec), _modified_time());
+            }
+
+            return true;
+        }
+        catch (std::exception&) {
+            return false;
+        }
+    }
+
+    /**
+     * @brief Waits for a running consolidate_async()
+     * @note If it failed, the file still holds what it held before the snapshot. The retired journal segment
+     * together with the current one leads from there, so the next consolidation rewrites the whole file
+     */
+    void _finish_consolidation() {
+        if (!_consolidation.valid() || _consolidation.get()) return;
+
+        // Emptied instead of removed, its existence keeps the retired segment alive across a crash
+        std::error_code ec;
+        std::filesystem::resize_file(_snapshot_path, 0, ec);
+
+        _persisted_lines = _fallback_lines;
+        _trailing_newline = _fallback_trailing_newline;
+        _dirty_from = 0;
+        _shifted_from = 0;
+        _patched_lines.clear();
+        _needs_consolidation = true;
+    }
+
+    /**
+     * @brief Removes the journal once the file holds every change
+     * @note The snapshot file of a failed consolidate_async() goes as well, after the retired segment it guards
+     */
+    void _drop_journal() {
+        _journal.destroy();
+
+        std::error_code ec;
+        std::filesystem::remove(_snapshot_path, ec);
+    }
+
+    /**
+     * @brief Attempts to rewrite the file to save all changes
+     * @note Saving isn't guaranteed. In case of a failure, the journal file is kept alive
+     */
+    void _consolidate() {
+        _finish_consolidation();
+        if (!_needs_consolidation) return;
+
+        // As long as no line on disk moved, the file can be patched and extended instead of rewritten. A retired
+        // journal segment isn't part of the file yet, so it always needs a rewrite
+        if (_shifted_from >= _persisted_lines && !_journal.retired() && _consolidate_in_place()) return;
+
+        // Lines before _dirty_from are still exactly as they are on disk
+        const size_t kept = std::min(_dirty_from, _persisted_lines);
+
+        std::filesystem::path write_path = _root_path;
+        write_path.replace_extension(".tmp");
+        uint64_t offset = 0;
+        size_t lines = 0;
+
+        // The unchanged prefix is copied byte for byte instead of being written line by line
+        if (kept > 0) {
+            if (const uint64_t prefix = _persisted_offset(kept); _copy_prefix(write_path, prefix)) {
+                offset = prefix;
+                lines = kept;
+            }
+        }
+
+        // Measuring paged lines up front would load every page twice
+        BlockWriter out(write_path, lines > 0, _options.load_mode == LoadMode::Paged ? 0 : _bytes_from(lines));
+
+        if (!out.is_open()) {
+            _journal.save();
+            return;
+        }
+
+        std::optional<IndexWriter> index;
+        std::vector<uint64_t> page_offsets = _persisted_page_offsets(lines);
+        _open_index(index, lines);
+
+        for (auto it = _index_order.iterator_at(lines); it != _index_order.end(); ++it) {
+            const std::string_view line = _line(*it);
+
+            if (index) index->add(offset);
+            if (_options.load_mode == LoadMode::Paged && lines % PAGE_LINES == 0) page_offsets.push_back(offset);
+
+            out.write_line(line);
+            offset += line.size() + 1;
+            ++lines;
+        }
+
+        std::error_code ec;
+
+        // The rewritten file has to be on disk before it replaces the old one and the journal is dropped
+        if (!out.finish() || (_options.durability != Durability::None && !_sync_file(write_path))) {
+            std::filesystem::remove(write_path, ec);
+            _journal.save();
+            return;
+        }
+
+        std::filesystem::rename(write_path, _root_path, ec);
+
+        if (ec) {
+            std::filesystem::remove(write_path, ec);
+            _journal.save();
+            return;
+        }
+
+        if (_options.durability != Durability::None) _sync_directory(_root_path);
+        _drop_journal();
+        _needs_consolidation = false;
+        _dirty_from = std::numeric_limits<size_t>::max();
+        _shifted_from = std::numeric_limits<size_t>::max();
+        _patched_lines.clear();
+        _trailing_newline = true;
+        _persisted_lines = lines;
+
+        if (index) {
+            index->finish(std::filesystem::file_size(_root_path, ec), _modified_time());
+        }
+
+        // Everything is on disk now, so paged mode can let go of the modified lines as well
+        if (_options.load_mode == LoadMode::Paged) {
+            _rebase_pages(page_offsets, lines, offset);
+        }
+    }
+
+    /**
+     * @brief Saves changes by patching overwritten lines and appending new lines to the root path
+     * @return True if the file was updated in place, false if a rewrite is necessary
+     * @note Only valid if no line on disk was erased or inserted since the last consolidation, and every
+     * overwritten line kept its length. The journal is saved before any byte is patched, so replaying it after
+     * a crash simply patches the same lines again. Appending is guarded by a Commit record holding the old and
+     * new file size, so a crash halfway through can be undone
+     */
+    bool _consolidate_in_place() {
+        std::error_code ec;
+        const uint64_t base_size = std::filesystem::file_size(_root_path, ec);
+        if (ec || _persisted_lines > _index_order.size()) return false;
+
+        std::vector<std::pair<uint64_t, std::string_view>> patches;
+        if (!_collect_patches(patches)) return false;
+
+        const auto appended = _index_order.iterator_at(_persisted_lines);
+        const bool appending = appended != _index_order.end();
+        uint64_t final_size = base_size + (_trailing_newline ? 0 : 1);
+
+        for (auto it = appended; it != _index_order.end(); ++it) {
+            final_size += _line(*it).size() + 1;
+        }
+
+        std::optional<IndexWriter> index;
+        std::vector<uint64_t> page_offsets = _persisted_page_offsets(_persisted_lines);
+        _open_index(index, _persisted_lines);
+
+        if (!patches.empty()) {
+            _journal.save();
+            if (!_patch_lines(patches)) return false;
+        }
+
+        uint64_t offset = base_size;
+        size_t lines = _persisted_lines;
+
+        if (appending) {
+            _journal.record(Command::Commit, base_size, final_size);
+            _journal.save();
+
+            BlockWriter out(_root_path, true, final_size - base_size);
+            if (!out.is_open()) return false;
+
+            if (!_trailing_newline) {
+                out.write("\n");
+                ++offset;
+            }
+
+            for (auto it = appended; it != _index_order.end(); ++it) {
+                const std::string_view line = _line(*it);
+
+                if (index) index->add(offset);
+                if (_options.load_mode == LoadMode::Paged && lines % PAGE_LINES == 0) page_offsets.push_back(offset);
+
+                out.write_line(line);
+                offset += line.size() + 1;
+                ++lines;
+            }
 
-                callback(command, args);
+            if (!out.finish()) {
+                std::filesystem::resize_file(_root_path, base_size, ec);
+                return false;
             }
         }
 
-        /**
-         * @brief Removes the journal file
-         */
-        void destroy() const {
-            std::filesystem::remove(_journal_path);
+        // Patches and appended lines have to be on disk before the journal which repeats them is dropped. The
+        // appended lines are cut off again, since later records would keep the Commit from being recognized
+        if (_options.durability != Durability::None && !_sync_file(_root_path)) {
+            if (appending) std::filesystem::resize_file(_root_path, base_size, ec);
+            return false;
         }
 
-        /**
-         * @brief Appends unsaved commands to the journal
-         */
-        void save() {
-            if (!_outdated) return;
-
-            std::ofstream out(_journal_path, std::ios::app);
+        _drop_journal();
+        _needs_consolidation = false;
+        _dirty_from = std::numeric_limits<size_t>::max();
+        _shifted_from = std::numeric_limits<size_t>::max();
+        _patched_lines.clear();
+        _trailing_newline = _trailing_newline || appending;
+        _persisted_lines = lines;
 
-            for (const auto& command : _pending_commands) {
-                out << command << "\n";
-            }
+        if (index) {
+            index->finish(std::filesystem::file_size(_root_path, ec), _modified_time());
+        }
 
-            out.close();
-            out.flush();
-            _pending_commands.clear();
-            _outdated = false;
+        if (_options.load_mode == LoadMode::Paged) {
+            _rebase_pages(page_offsets, lines, offset);
         }
 
-        /**
-         * @brief Checks whether the journal file exists
-         * @return True if the journal file exists
-         */
-        [[nodiscard]] bool exists() const {
-            return std::filesystem::exists(_journal_path);
+        return true;
+    }
+
+    /**
+     * @brief Looks up where every overwritten line on disk starts
+     * @param patches Receives the byte offset and new text of each overwritten line, ordered by offset
+     * @return True if every overwritten line kept its length, false if the file has to be rewritten
+     */
+    bool _collect_patches(std::vector<std::pair<uint64_t, std::string_view>>& patches) const {
+        for (const auto& [position, length] : _patched_lines) {
+            if (_line(_index_order[position]).size() != length) return false;
         }
 
-    private:
-        /**
-         * @brief Checks whether a string only contains numbers
-         * @param str String to check
-         * @return True if the string only contains numbers
-         */
-        [[nodiscard]] static bool _is_numerical(const std::string& str) {
-            return std::find_if(str.begin(), str.end(), [](const char c) {
-                return !std::isdigit(c);
-            }) == str.end();
+        // Paged mode only has to read the pages in front of the patched lines
+        if (_options.load_mode == LoadMode::Paged) {
+            for (const auto& [position, length] : _patched_lines) {
+                patches.emplace_back(_persisted_offset(position), _line(_index_order[position]));
+            }
+
+            return true;
         }
 
-        /**
-         * @brief Attempts to extract a token from a command line
-         * @param line Base command line
-         * @param offset Where to start reading the new token from
-         * @return Extracted token
-         */
-        static Token _extract_token(const std::string& line, size_t& offset) {
-            const size_t delimiter = line.find(COMMAND_DELIMITER, offset);
+        // Every line before the last patch still has its original length, so one pass yields all offsets
+        auto next = _patched_lines.begin();
+        uint64_t offset = 0;
+        size_t position = 0;
 
-            if (delimiter == std::string::npos) {
-                offset = std::string::npos;
-                return {};
+        for (auto it = _index_order.begin(); next != _patched_lines.end(); ++it, ++position) {
+            if (position == next->first) {
+                patches.emplace_back(offset, _cache[*it]);
+                ++next;
             }
 
-            std::string data = line.substr(offset, delimiter - offset);
+            offset += _cache[*it].size() + 1;
+        }
 
-            if (!_is_numerical(data)) {
-                offset = std::string::npos;
-                return {};
-            }
+        return true;
+    }
 
-            // Each token has a fixed length, e.g. 11;Hello world; (11 in this case)
-            const size_t length = std::stoull(data);
+    /**
+     * @brief Writes the new text of overwritten lines over their old bytes inside the root path
+     * @param patches Byte offset and text of each line
+     * @return True if every patch was written
+     */
+    bool _patch_lines(const std::vector<std::pair<uint64_t, std::string_view>>& patches) const {
+#ifdef FILEMANAGER_POSIX
+        const int file = ::open(_root_path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (file < 0) return false;
+        bool written = true;
 
-            if (line.size() - delimiter - 1 <= length) {
-                offset = std::string::npos;
-                return {};
+        for (const auto& [offset, text] : patches) {
+            for (size_t done = 0; written && done < text.size();) {
+                const ssize_t bytes = ::pwrite(file, text.data() + done, text.size() - done, static_cast<off_t>(offset + done));
+                if (bytes < 0 && errno == EINTR) continue;
+
+                written = bytes > 0;
+                if (written) done += static_cast<size_t>(bytes);
             }
+        }
 
-            data = line.substr(delimiter + 1, length);
-            const size_t new_offset = delimiter + 1 + length + 1;
-            offset = new_offset < line.size() ? new_offset : std::string::npos;
+        return ::close(file) == 0 && written;
+#else
+        std::fstream file(_root_path, std::ios::in | std::ios::out | std::ios::binary);
 
-            return {true, std::move(data)};
+        for (const auto& [offset, text] : patches) {
+            file.seekp(static_cast<std::streamoff>(offset));
+            file.write(text.data(), static_cast<std::streamsize>(text.size()));
         }
 
-        /**
-         * @brief Serializes a parameter for the journal
-         * @param value What to convert
-         * @return Serialized value
-         */
-        template <typename T>
-        static std::string tokenize(T value) {
-            std::string result;
+        file.close();
+        return !file.fail();
+#endif
+    }
 
-            if constexpr (std::is_same_v<T, std::string>) {
-                result = std::move(value);
-            }
-            else if constexpr (std::is_same_v<T, const char*>) {
-                result = std::string(value);
-            }
-            else {
-                result = std::to_string(value);
+    /**
+     * @brief Computes where a line starts inside the root path
+     * @param position Position of the line, every line before it has to be unchanged since the last consolidation
+     * @return Byte offset of the line
+     */
+    [[nodiscard]] uint64_t _persisted_offset(const size_t position) const {
+        if (_options.load_mode == LoadMode::Paged) {
+            if (position % PAGE_LINES == 0 && position / PAGE_LINES < _pages.size()) {
+                return _pages[position / PAGE_LINES].offset;
             }
 
-            return std::to_string(result.size()) + COMMAND_DELIMITER + result + COMMAND_DELIMITER;
-        }
+            // Only the page holding the line before the position has to be loaded
+            const size_t page_index = (position - 1) / PAGE_LINES;
+            const Page& page = _load_page(page_index);
+            uint64_t offset = _pages[page_index].offset;
 
-        const std::filesystem::path _journal_path;
-        std::vector<std::string> _pending_commands;
-        bool _outdated = false;
-    };
+            for (size_t i = page_index * PAGE_LINES; i < position; ++i) {
+                offset += page.lines[i % PAGE_LINES].size() + 1;
+            }
 
-public:
-    explicit FileManager(std::filesystem::path file_path) :
-        _journal(file_path.parent_path() / (file_path.stem().string() + "_journal" + file_path.extension().string())),
-        _root_path(std::move(file_path))
-    {
-        if (std::filesystem::path tmp_path = _root_path ; std::filesystem::exists(tmp_path.replace_extension(".tmp"))) {
-            std::filesystem::remove(tmp_path);
+            return offset;
         }
 
-        if (std::filesystem::exists(_root_path)) {
-            _init_cache();
-        }
+        const auto end = _index_order.iterator_at(position);
+        uint64_t offset = 0;
 
-        if (_journal.exists()) {
-            _journal.replay([this](const Command command, const std::vector<std::string>& args) {
-                _execute_command(command, args);
-            });
-            _consolidate();
+        for (auto it = _index_order.begin(); it != end; ++it) {
+            offset += _cache[*it].size() + 1;
         }
-    }
 
-    ~FileManager() {
-        try {
-            _consolidate();
-        }
-        catch (std::exception& e) {
-            std::cerr << e.what() << std::endl;
-        }
+        return offset;
     }
 
     /**
-     * @brief Returns a copy of the text at the specified index
-     * @param index Line you want to read
-     * @return Copy of the text at the given index
+     * @brief Computes how many bytes the lines from a position onward take up once written
+     * @param position Position of the first line
+     * @return Size of the lines including their newlines
      */
-    [[nodiscard]] std::string read(const size_t index) const {
-        if (index >= _index_order.size()) throw std::out_of_range("index out of range");
-        return _cache[_index_order[index]];
+    [[nodiscard]] uint64_t _bytes_from(const size_t position) const {
+        uint64_t bytes = 0;
+
+        for (auto it = _index_order.iterator_at(position); it != _index_order.end(); ++it) {
+            bytes += _line(*it).size() + 1;
+        }
+
+        return bytes;
     }
 
     /**
-     * @brief Returns a copy of the first line of the file
-     * @return Copy of the first line
+     * @brief Collects the offsets of the pages which start within the unchanged prefix of the root path
+     * @param kept Amount of unchanged lines
+     * @return Page offsets, empty outside of paged mode
      */
-    [[nodiscard]] std::string first() const {
-        if (_index_order.empty()) throw std::out_of_range("file is empty");
-        return _cache[_index_order.front()];
+    [[nodiscard]] std::vector<uint64_t> _persisted_page_offsets(const size_t kept) const {
+        std::vector<uint64_t> page_offsets;
+        if (_options.load_mode != LoadMode::Paged) return page_offsets;
+
+        for (size_t i = 0; i < _pages.size() && i * PAGE_LINES < kept; ++i) {
+            page_offsets.push_back(_pages[i].offset);
+        }
+
+        return page_offsets;
     }
 
     /**
-     * @brief Returns a copy of the last line of the file
-     * @return Copy of the last line
+     * @brief Prepares the sidecar for a consolidation which keeps the first lines of the root path
+     * @param index Receives the writer, left empty if sidecars are disabled
+     * @param kept Amount of unchanged lines, the writer continues after them
+     * @note The current sidecar is reused if it still matches the file, otherwise the kept lines are indexed again
      */
-    [[nodiscard]] std::string last() const {
-        if (_index_order.empty()) throw std::out_of_range("file is empty");
-        return _cache[_index_order.back()];
+    void _open_index(std::optional<IndexWriter>& index, const size_t kept) const {
+        if (!_options.index_sidecar) return;
+
+        if (const auto header = _valid_index_header(); header && header->lines == _persisted_lines) {
+            index.emplace(_index_path, kept);
+            return;
+        }
+
+        index.emplace(_index_path);
+        const auto end = _index_order.iterator_at(kept);
+        uint64_t offset = 0;
+
+        for (auto it = _index_order.begin(); it != end; ++it) {
+            index->add(offset);
+            offset += _line(*it).size() + 1;
+        }
     }
 
     /**
-     * @brief Copies every line of the file
-     * @return Copy of every line
+     * @brief Copies the first bytes of the root path into a new file
+     * @param write_path File to create
+     * @param bytes Amount of bytes to copy
+     * @return True if the prefix was copied completely
      */
-    [[nodiscard]] std::vector<std::string> all() const {
-        std::vector<std::string> result;
-        result.reserve(_index_order.size());
+    bool _copy_prefix(const std::filesystem::path& write_path, const uint64_t bytes) const {
+        std::error_code ec;
+        if (std::filesystem::file_size(_root_path, ec) < bytes || ec) return false;
 
-        for (const auto index : _index_order) {
-            result.push_back(_cache[index]);
+#ifdef __linux__
+        // copy_file_range lets the kernel copy, or even share, the blocks without a trip through user space
+        const int in = ::open(_root_path.c_str(), O_RDONLY | O_CLOEXEC);
+        const int out = ::open(write_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        uint64_t remaining = bytes;
+
+        while (in >= 0 && out >= 0 && remaining > 0) {
+            const ssize_t copied = ::copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+            if (copied <= 0) break;
+            remaining -= static_cast<uint64_t>(copied);
         }
 
-        return result;
+        if (in >= 0) ::close(in);
+        if (out >= 0 && ::close(out) == 0 && remaining == 0) return true;
+#endif
+
+        std::ifstream in_stream(_root_path, std::ios::binary);
+        std::ofstream out_stream(write_path, std::ios::trunc | std::ios::binary);
+        std::unique_ptr<char[]> buffer(new char[SCAN_BLOCK_SIZE]);
+
+        for (uint64_t remaining_bytes = bytes; remaining_bytes > 0;) {
+            const auto chunk = static_cast<std::streamsize>(std::min<uint64_t>(remaining_bytes, SCAN_BLOCK_SIZE));
+            if (!in_stream.read(buffer.get(), chunk) || !out_stream.write(buffer.get(), chunk)) return false;
+            remaining_bytes -= static_cast<uint64_t>(chunk);
+        }
+
+        out_stream.close();
+        return static_cast<bool>(out_stream);
     }
 
     /**
-     * @brief Append the given arguments to the file
-     * @param args Content to append
+     * @brief Undoes or completes an interrupted _consolidate_in_place() before the root path is loaded
+     * @note If the journal ends with a Commit record, the append either finished, in which case the journal
+     * is obsolete, or it has to be cut off again so replaying the journal doesn't duplicate lines
      */
-    template <typename... Args>
-    void append(Args... args) {
-        std::stringstream ss;
-        (ss << ... << args);
+    void _recover_commit() {
+        std::optional<std::pair<uint64_t, uint64_t>> commit;
+
+        _journal.last_record([&commit](const Command command, const std::vector<std::string_view>& args) {
+            uint64_t base_size = 0;
+            uint64_t final_size = 0;
+
+            if (command == Command::Commit && args.size() >= 2 && _parse_number(args[0], base_size) && _parse_number(args[1], final_size)) {
+                commit.emplace(base_size, final_size);
+            }
+            else {
+                commit.reset();
+            }
+        });
+
+        if (!commit) return;
+
+        std::error_code ec;
+        const uint64_t file_size = std::filesystem::file_size(_root_path, ec);
+        if (ec) return;
 
-        _apply_append(ss.str());
-        _journal.record(Command::Append, ss.str());
+        if (file_size == commit->second) {
+            _drop_journal();
+        }
+        else if (file_size > commit->first) {
+            std::filesystem::resize_file(_root_path, commit->first);
+        }
     }
 
     /**
-     * @brief Overwrites the specified index with the given arguments
-     * @param index Line to overwrite
-     * @param args Content to overwrite with
+     * @brief Checks whether the last line of the root path is terminated
+     * @return True if the file is empty or ends with a newline
      */
-    template <typename... Args>
-    void overwrite(const size_t index, Args... args) {
-        std::stringstream ss;
-        (ss << ... << args);
+    [[nodiscard]] bool _ends_with_newline() const {
+        std::ifstream in(_root_path, std::ios::binary | std::ios::ate);
+        if (!in.is_open() || in.tellg() <= 0) return true;
 
-        _apply_overwrite(index, ss.str());
-        _journal.record(Command::Overwrite, index, ss.str());
+        in.seekg(-1, std::ios::end);
+        return in.get() == '\n';
     }
 
     /**
-     * @brief Deletes a line, shifting later elements down
-     * @param index Which line to erase
+     * @brief Concatenates the given arguments into _format_buffer
+     * @param args Values to format
+     * @return View of the formatted text, valid until the next call
      */
-    void erase(const size_t index) {
-        _apply_erase(index);
-        _journal.record(Command::Erase, index);
+    template <typename... Args>
+    std::string_view _format(Args&&... args) {
+        _format_buffer.clear();
+        (_append_formatted(_format_buffer, std::forward<Args>(args)), ...);
+        return _format_buffer;
     }
 
     /**
-     * @brief Deletes everything
+     * @brief Appends a value to a string the same way operator<< of an std::ostream with default flags would
+     * @param out String to append to
+     * @param value Value to format
+     * @note Text and numbers skip the stream entirely, other types still go through an std::ostringstream
      */
-    void clear() {
-        _apply_clear();
-        _journal.record(Command::Clear);
+    template <typename T>
+    static void _append_formatted(std::string& out, const T& value) {
+        if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            out.append(std::string_view(value));
+        }
+        else if constexpr (std::is_same_v<T, char> || std::is_same_v<T, signed char> || std::is_same_v<T, unsigned char>) {
+            out.push_back(static_cast<char>(value));
+        }
+        else if constexpr (std::is_same_v<T, bool>) {
+            out.push_back(value ? '1' : '0');
+        }
+        else if constexpr (std::is_integral_v<T>) {
+            char digits[24];
+            const auto result = std::to_chars(std::begin(digits), std::end(digits), value);
+            out.append(digits, result.ptr);
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            // Streams print floating point numbers like %g with a precision of 6
+            char digits[64];
+            const auto result = std::to_chars(std::begin(digits), std::end(digits), value, std::chars_format::general, 6);
+            out.append(digits, result.ptr);
+        }
+        else {
+            std::ostringstream stream;
+            stream << value;
+            out += stream.str();
+        }
     }
 
     /**
-     * @brief Saves all changes
-     * @note Changes aren't saved to the main file, the journal is flushed instead
-     * to increase performance
+     * @brief Journals the lines appended since a bulk append started as one Batch record
+     * @param begin Size of _cache before the first line was appended
      */
-    void save() {
-        _journal.save();
+    void _record_appended(const size_t begin) {
+        if (begin == _cache.size()) return;
+        _journal.record_range(Command::Batch, _cache.begin() + static_cast<std::ptrdiff_t>(begin), _cache.end());
     }
 
-    [[nodiscard]] size_t size() const {
-        return _index_order.size();
+    /**
+     * @brief Makes room for lines which are about to be appended
+     * @param count Amount of new lines
+     * @note Capacity still grows geometrically, so many small bulk appends don't reallocate every time
+     */
+    void _reserve_lines(const size_t count) {
+        if (_cache.size() + count > _cache.capacity()) {
+            _cache.reserve(std::max(_cache.size() + count, _cache.capacity() * 2));
+        }
+
+        _index_order.reserve(_index_order.size() + count);
     }
 
-    [[nodiscard]] bool empty() const {
-        return _index_order.empty();
+    void _apply_append(const std::string_view text) {
+        _cache.push_back(_arena.store(text));
+        _index_order.push_back(_paged_lines + _cache.size() - 1);
+        _needs_consolidation = true;
     }
 
-private:
-    /**
-     * @brief Initializes the cache with the content of the root path
-     */
-    void _init_cache() {
-        std::ifstream in(_root_path);
-        std::string line;
-        size_t index = 0;
+    void _apply_overwrite(const size_t index, const std::string_view text) {
+        if (index >= _index_order.size()) throw std::invalid_argument("Invalid index");
+        // The first overwrite of a line on disk remembers its length to tell whether it can be patched in place
+        if (index < _persisted_lines && _shifted_from >= _persisted_lines) {
+            _patched_lines.try_emplace(index, _line(_index_order[index]).size());
+        }
 
-        if (!in.is_open()) throw std::runtime_error("could not open file");
+        std::string_view& line = _slot(_index_order[index]);
+        _dirty_from = std::min(_dirty_from, index);
+        _release(line);
+        line = _arena.store(text);
+        _needs_consolidation = true;
+        if (_arena.fragmented()) _compact();
+    }
 
-        // Reserve vector space by guessing how many lines the file has
-        if (const auto file_size = std::filesystem::file_size(_root_path); file_size > 0) {
-            const size_t estimated_rows = file_size / ESTIMATED_CHARS_PER_ROW + 1;
-            _cache.reserve(estimated_rows);
-            _index_order.reserve(estimated_rows);
-        }
+    void _apply_insert(const size_t index, const std::string_view text) {
+        if (index > _index_order.size()) throw std::invalid_argument("Invalid index");
+        _dirty_from = std::min(_dirty_from, index);
+        _shifted_from = std::min(_shifted_from, index);
+        _cache.push_back(_arena.store(text));
+        _index_order.insert(index, _paged_lines + _cache.size() - 1);
+        _needs_consolidation = true;
+    }
 
-        while (std::getline(in, line)) {
-            _cache.push_back(std::move(line));
-            _index_order.push_back(index);
-            ++index;
-        }
+    void _apply_erase(const size_t index) {
+        if (index >= _index_order.size()) throw std::invalid_argument("Invalid index");
+        _forget(_index_order[index]);
+        _index_order.erase(index);
+        _dirty_from = std::min(_dirty_from, index);
+        _shifted_from = std::min(_shifted_from, index);
+        _needs_consolidation = true;
+        _compact_erased();
     }
 
     /**
-     * @brief Attempts to rewrite the file to save all changes
-     * @note Saving isn't guaranteed. In case of a failure, the journal file is kept alive
+     * @brief Compacts after lines were erased, once the garbage outweighs the live lines
+     * @note Waiting for that keeps repeated erases amortized O(1)
      */
-    void _consolidate() {
-        if (!_needs_consolidation) return;
-
-        std::filesystem::path write_path = _root_path;
-        write_path.replace_extension(".tmp");
-        std::ofstream out(write_path, std::ios::trunc);
+    void _compact_erased() {
+        if (_options.load_mode == LoadMode::Paged ? _arena.fragmented() : _cache.size() - _index_order.size() >= std::max<size_t>(COMPACT_THRESHOLD, _index_order.size())) _compact();
+    }
 
-        if (!out.is_open()) {
-            _journal.save();
-            return;
-        }
+    /**
+     * @brief Erases several ranges of lines and compacts at most once
+     * @param ranges Sorted, non-overlapping [begin, end) ranges of positions
+     */
+    void _apply_erase_ranges(const std::vector<std::pair<size_t, size_t>>& ranges) {
+        if (ranges.empty()) return;
+        size_t previous = 0;
 
-        for (const auto index : _index_order) {
-            out << _cache[index] << "\n";
+        for (const auto& [begin, end] : ranges) {
+            if (begin < previous || begin >= end || end > _index_order.size()) throw std::invalid_argument("Invalid range");
+            previous = end;
         }
 
-        out.close();
-        std::error_code ec;
-        std::filesystem::rename(write_path, _root_path, ec);
+        for (const auto& [begin, end] : ranges) {
+            auto it = _index_order.iterator_at(begin);
 
-        if (ec) {
-            std::filesystem::remove(write_path, ec);
-            _journal.save();
-            return;
+            for (size_t position = begin; position < end; ++position, ++it) {
+                _forget(*it);
+            }
         }
 
-        _journal.destroy();
-        _needs_consolidation = false;
-    }
-
-    void _apply_append(std::string text) {
-        _cache.push_back(std::move(text));
-        _index_order.push_back(_cache.size() - 1);
+        _index_order.erase(ranges);
+        _dirty_from = std::min(_dirty_from, ranges.front().first);
+        _shifted_from = std::min(_shifted_from, ranges.front().first);
         _needs_consolidation = true;
+        _compact_erased();
     }
 
-    void _apply_overwrite(const size_t index, std::string text) {
-        if (index >= _index_order.size()) throw std::invalid_argument("Invalid index");
-        _cache[_index_order[index]] = std::move(text);
-        _needs_consolidation = true;
-    }
+    /**
+     * @brief Journals erased ranges as one EraseRanges record
+     * @param ranges Ranges passed to _apply_erase_ranges()
+     */
+    void _record_erased(const std::vector<std::pair<size_t, size_t>>& ranges) {
+        if (ranges.empty()) return;
 
-    void _apply_erase(const size_t index) {
-        if (index >= _index_order.size()) throw std::invalid_argument("Invalid index");
-        _index_order.erase(_index_order.begin() + static_cast<int>(index));
-        _needs_consolidation = true;
-        if (_cache.size() >= _index_order.size() + 50) _compact();
+        std::vector<size_t> bounds;
+        bounds.reserve(ranges.size() * 2);
+
+        for (const auto& [begin, end] : ranges) {
+            bounds.push_back(begin);
+            bounds.push_back(end);
+        }
+
+        _journal.record_range(Command::EraseRanges, bounds.begin(), bounds.end());
     }
 
     void _apply_clear() {
         if (_index_order.empty()) return;
+        _dirty_from = 0;
+        _shifted_from = 0;
+        _drop_pages();
         _cache.clear();
+        _arena.clear();
         _index_order.clear();
         _needs_consolidation = true;
     }
 
+    /**
+     * @brief Accounts a line which is no longer referenced as arena garbage
+     * @param line Line that was erased or overwritten
+     */
+    void _release(const std::string_view line) {
+        if (!_mapping || !_mapping->contains(line)) {
+            _arena.release(line);
+        }
+    }
+
     /**
      * @brief Rebuilds internal cache to let go of unused lines
-     * @note Should only be called when calling erase() multiple times
+     * @note Called by _compact_erased() once erased lines outweigh the live ones, and by overwrite() once the
+     * arena is fragmented by replaced lines
      */
     void _compact() {
-        std::vector<std::string> new_cache;
+        // Paged lines are addressed by their id, so only the arena is rebuilt in place
+        if (_options.load_mode == LoadMode::Paged) {
+            LineArena new_arena;
+
+            for (auto& [id, line] : _page_overrides) {
+                line = new_arena.store(line);
+            }
+
+            for (const auto index : _index_order) {
+                if (index >= _paged_lines) {
+                    _cache[index - _paged_lines] = new_arena.store(_cache[index - _paged_lines]);
+                }
+            }
+
+            _arena = std::move(new_arena);
+            return;
+        }
+
+        std::vector<std::string_view> new_cache;
+        LineArena new_arena;
         new_cache.reserve(_index_order.size());
 
+        // Lines still backed by the mapping stay there, only arena text is carried over
         for (const auto index : _index_order) {
-            new_cache.push_back(std::move(_cache[index]));
+            if (_mapping && _mapping->contains(_cache[index])) {
+                new_cache.push_back(_cache[index]);
+            }
+            else {
+                new_cache.push_back(new_arena.store(_cache[index]));
+            }
         }
 
         _cache = std::move(new_cache);
-        _index_order.clear();
-        _index_order.resize(_cache.size());
-        std::iota(_index_order.begin(), _index_order.end(), 0);
+        _arena = std::move(new_arena);
+        _index_order.reset(_cache.size());
+    }
+
+    /**
+     * @brief Parses a journal argument as an unsigned integer
+     * @param text Argument to parse
+     * @param value Receives the number
+     * @return True if the whole argument is a number
+     */
+    template <typename T>
+    static bool _parse_number(const std::string_view text, T& value) {
+        const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return ec == std::errc() && end == text.data() + text.size() && !text.empty();
     }
 
     /**
      * @brief Calls internal file manager methods based on arguments. Necessary for Journal::replay()
      * @param command Type of command to execute e.g. Append
-     * @param args Arguments to pass during function call
+     * @param args Arguments to pass during function call, only copied if a line is stored
+     * @note Records with malformed numbers are skipped like records with missing arguments
      */
-    void _execute_command(const Command command, const std::vector<std::string>& args) {
+    void _execute_command(const Command command, const std::vector<std::string_view>& args) {
+        size_t number = 0;
+
         switch (command) {
             case Command::Append:
                 if (args.empty()) break;
                 _apply_append(args[0]);
                 break;
+            case Command::Batch: {
+                // A torn record holds fewer lines than announced and is dropped as a whole
+                if (args.empty() || !_parse_number(args[0], number) || args.size() - 1 != number) break;
+                _reserve_lines(args.size() - 1);
+
+                for (size_t i = 1; i < args.size(); ++i) {
+                    _apply_append(args[i]);
+                }
+
+                break;
+            }
             case Command::Overwrite:
-                if (args.size() < 2) break;
-                _apply_overwrite(std::stoull(args[0]), args[1]);
+                if (args.size() < 2 || !_parse_number(args[0], number)) break;
+                _apply_overwrite(number, args[1]);
+                break;
+            case Command::Insert:
+                if (args.size() < 2 || !_parse_number(args[0], number)) break;
+                _apply_insert(number, args[1]);
                 break;
             case Command::Erase:
-                if (args.empty()) break;
-                _apply_erase(std::stoull(args[0]));
+                if (args.empty() || !_parse_number(args[0], number)) break;
+                _apply_erase(number);
+                break;
+            case Command::EraseRanges: {
+                if (args.empty() || !_parse_number(args[0], number) || args.size() - 1 != number || number % 2 != 0) break;
+                std::vector<std::pair<size_t, size_t>> ranges(number / 2);
+                bool valid = true;
+
+                for (size_t i = 0; i < ranges.size() && valid; ++i) {
+                    valid = _parse_number(args[2 * i + 1], ranges[i].first) && _parse_number(args[2 * i + 2], ranges[i].second);
+                }
+
+                if (valid) _apply_erase_ranges(ranges);
                 break;
+            }
             case Command::Clear:
                 _apply_clear();
+                break;
+            case Command::Commit:
+                break;
+            case Command::PopFront:
+                if (args.empty() || !_parse_number(args[0], number)) break;
+
+                for (; number > 0 && !_index_order.empty(); --number) {
+                    _apply_erase(0);
+                }
+
                 break;
             default:
                 throw std::invalid_argument("Invalid command");
@@ -465,9 +4171,37 @@ private:
 
     Journal _journal;
     const std::filesystem::path _root_path;
-    std::vector<std::string> _cache;
-    std::vector<size_t> _index_order;
+    const std::filesystem::path _index_path;
+    // Written by consolidate_async() and renamed over the root path once complete
+    const std::filesystem::path _snapshot_path;
+    const Options _options;
+    std::shared_ptr<MappedFile> _mapping;
+    // Offset/length table of every line with an id from _paged_lines on, pointing either into _mapping or into _arena
+    std::vector<std::string_view> _cache;
+    LineArena _arena;
+    LineOrder _index_order;
+    // LoadMode::Paged only, lines with an id below _paged_lines are read from _pages unless they were overwritten
+    std::unordered_map<size_t, std::string_view> _page_overrides;
+    mutable std::vector<Page> _pages;
+    mutable std::vector<size_t> _resident_pages;
+    mutable uint64_t _resident_bytes = 0;
+    mutable uint64_t _page_clock = 0;
+    mutable std::ifstream _page_reader;
+    size_t _paged_lines = 0;
+    // Lines of the root path as of the last load or consolidation, and the lowest position changed since then
+    size_t _persisted_lines = 0;
+    size_t _dirty_from = std::numeric_limits<size_t>::max();
+    // Lowest position erased or inserted at, and the original length of every overwritten line on disk
+    size_t _shifted_from = std::numeric_limits<size_t>::max();
+    std::map<size_t, size_t> _patched_lines;
+    // Reused by append(), overwrite() and insert(), so formatting doesn't allocate once it has grown
+    std::string _format_buffer;
+    bool _trailing_newline = true;
     bool _needs_consolidation = false;
+    // Running consolidate_async(), and the state of the root path to fall back to if it fails
+    std::future<bool> _consolidation;
+    size_t _fallback_lines = 0;
+    bool _fallback_trailing_newline = true;
 };
 
 #endif //FILEMANAGER_FILEMANAGER_H
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/filemanager.h"
+
+// Keeps several threads appending and saving with group commit while the file is consolidated in the background
+// over and over, then checks that every row survived reopening the file.
+// Usage: Async-Consolidation [rows per thread]
+int main(int argc, char* argv[]) {
+    const size_t rows = argc > 1 ? std::stoull(argv[1]) : 2000;
+    const std::filesystem::path path = "async_consolidation.txt";
+    const size_t threads = 4;
+
+    FileManager::Options options;
+    options.durability = FileManager::Durability::GroupCommit;
+    options.group_commit_window = std::chrono::milliseconds(2);
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t consolidations = 0;
+
+    {
+        FileManager fm(path, options);
+        std::mutex mutex;
+        std::vector<std::thread> writers;
+        size_t finished = 0;
+
+        // Rows journaled by an interrupted run would be replayed on top
+        fm.clear();
+        fm.save();
+
+        for (size_t thread = 0; thread < threads; ++thread) {
+            writers.emplace_back([&, thread] {
+                for (size_t i = 0; i < rows; ++i) {
+                    // Modifications need exclusive access, saving doesn't
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        fm.append(thread, " ", i);
+                    }
+
+                    fm.save();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                ++finished;
+            });
+        }
+
+        for (bool done = false; !done;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = finished == threads;
+                fm.consolidate_async();
+                ++consolidations;
+            }
+
+            // Saving right after the journal was rotated has nothing left to write
+            fm.save();
+        }
+
+        for (auto& writer : writers) {
+            writer.join();
+        }
+    }
+
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    const FileManager fm(path);
+    std::vector<size_t> next(threads, 0);
+    bool valid = fm.size() == threads * rows;
+
+    for (const std::string_view row : fm.lines()) {
+        const size_t separator = row.find(' ');
+        const size_t thread = std::stoull(std::string(row.substr(0, separator)));
+        const size_t i = std::stoull(std::string(row.substr(separator + 1)));
+
+        // Rows of the same thread have to keep their order
+        if (thread >= threads || i != next[thread]++) valid = false;
+    }
+
+    std::cout << threads * rows << " rows, " << consolidations << " consolidations, " << elapsed.count() << " ms: "
+              << (valid ? "ok" : "rows are missing or out of order") << "\n";
+
+    std::filesystem::remove(path);
+    return valid ? 0 : 1;
+}
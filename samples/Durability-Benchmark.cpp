@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/filemanager.h"
+
+// Measures throughput and save latency of every durability mode with an increasing amount of writing threads.
+// Every thread appends a row and saves it right away, like a service acknowledging each request.
+// Usage: Durability-Benchmark [saves per thread]
+int main(int argc, char* argv[]) {
+    const size_t saves = argc > 1 ? std::stoull(argv[1]) : 200;
+    const std::filesystem::path path = "durability_benchmark.txt";
+    const size_t max_threads = std::max(8u, std::thread::hardware_concurrency());
+
+    for (const auto durability : {FileManager::Durability::None, FileManager::Durability::DataSync, FileManager::Durability::GroupCommit}) {
+        std::cout << (durability == FileManager::Durability::None ? "None" : durability == FileManager::Durability::DataSync ? "DataSync" : "GroupCommit") << "\n";
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            std::filesystem::remove(path);
+
+            FileManager::Options options;
+            options.durability = durability;
+
+            FileManager fm(path, options);
+            std::mutex mutex;
+            std::vector<std::vector<double>> latencies(threads);
+            std::vector<std::thread> writers;
+
+            const auto start = std::chrono::steady_clock::now();
+
+            for (size_t thread = 0; thread < threads; ++thread) {
+                writers.emplace_back([&, thread] {
+                    for (size_t i = 0; i < saves; ++i) {
+                        const auto begin = std::chrono::steady_clock::now();
+
+                        // Modifications need exclusive access, saving doesn't
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            fm.append("thread ", thread, " row ", i);
+                        }
+
+                        fm.save();
+                        latencies[thread].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+                    }
+                });
+            }
+
+            for (auto& writer : writers) {
+                writer.join();
+            }
+
+            const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+            std::vector<double> all;
+
+            for (const auto& thread_latencies : latencies) {
+                all.insert(all.end(), thread_latencies.begin(), thread_latencies.end());
+            }
+
+            std::sort(all.begin(), all.end());
+
+            std::cout << "  " << threads << " thread(s): " << static_cast<double>(all.size()) / elapsed.count() << " saves/s, "
+                      << "median " << all[all.size() / 2] << " us, p99 " << all[all.size() * 99 / 100] << " us\n";
+        }
+    }
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,42 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../include/filemanager.h"
+
+// Measures how long opening a large file takes with an increasing amount of indexing threads.
+// Usage: Load-Benchmark [size in MB]
+int main(int argc, char* argv[]) {
+    const size_t megabytes = argc > 1 ? std::stoull(argv[1]) : 1024;
+    const std::filesystem::path path = "load_benchmark.txt";
+
+    {
+        std::ofstream out(path, std::ios::trunc | std::ios::binary);
+        const std::string row(ESTIMATED_CHARS_PER_ROW - 1, 'x');
+
+        for (size_t written = 0; written < megabytes << 20; written += row.size() + 1) {
+            out << row << "\n";
+        }
+    }
+
+    const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (const auto mode : {FileManager::LoadMode::Stream, FileManager::LoadMode::Mapped}) {
+        std::cout << (mode == FileManager::LoadMode::Stream ? "Stream" : "Mapped") << "\n";
+
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            FileManager::Options options;
+            options.load_mode = mode;
+            options.load_threads = threads;
+
+            const auto start = std::chrono::steady_clock::now();
+            const FileManager fm(path, options);
+            const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+            std::cout << "  " << threads << " thread(s): " << elapsed.count() << " ms, " << fm.size() << " rows\n";
+        }
+    }
+
+    std::filesystem::remove(path);
+}